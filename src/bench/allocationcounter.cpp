@@ -0,0 +1,55 @@
+#include "allocationcounter.h"
+#include <QAtomicInteger>
+#include <stdlib.h>
+
+#if defined(__GLIBC__)
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+
+static QBasicAtomicInteger<qint64> allocations = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+extern "C" void *malloc(size_t size) Q_DECL_NOTHROW
+{
+    allocations.fetchAndAddRelaxed(1);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) Q_DECL_NOTHROW
+{
+    allocations.fetchAndAddRelaxed(1);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size) Q_DECL_NOTHROW
+{
+    allocations.fetchAndAddRelaxed(1);
+    return __libc_realloc(ptr, size);
+}
+
+bool AllocationCounter::isAvailable()
+{
+    return true;
+}
+
+qint64 AllocationCounter::count()
+{
+    return allocations.loadAcquire();
+}
+
+#else
+
+bool AllocationCounter::isAvailable()
+{
+    return false;
+}
+
+qint64 AllocationCounter::count()
+{
+    return 0;
+}
+
+#endif
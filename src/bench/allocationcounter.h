@@ -0,0 +1,17 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtGlobal>
+
+// Counts the heap allocations of the whole process, on all threads. On glibc malloc, calloc and
+// realloc are interposed, which catches operator new and the Qt containers alike; elsewhere
+// nothing is counted and isAvailable() is false.
+class AllocationCounter
+{
+public:
+    static bool isAvailable();
+    static qint64 count();
+};
+
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Benchmarks over the fonts and icons in test/
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = fontConverterBench
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+DEFINES += TEST_DATA_DIR=\\\"$$PWD/../../test\\\"
+
+include(../converter.pri)
+
+SOURCES += main.cpp \
+    suite.cpp \
+    allocationcounter.cpp \
+    ../glcd.cpp \
+    ../mcuprofile.cpp
+
+HEADERS += suite.h \
+    allocationcounter.h \
+    ../glcd.h \
+    ../mcuprofile.h
@@ -0,0 +1,503 @@
+#include <QGuiApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QMap>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <stdio.h>
+#include <limits.h>
+#include "converter.h"
+#include "rasterizer.h"
+#include "dither.h"
+#include "conversioncache.h"
+#include "suite.h"
+#include "glcd.h"
+
+
+struct Glyph{
+    QRect rect;
+    int targetWidth;
+    bool scaled;
+};
+
+// Runs fn until at least minMs milliseconds have passed, returns ns per call.
+template <typename F>
+static double measure(F fn, int minMs = 200)
+{
+    QElapsedTimer timer;
+    timer.start();
+    qint64 calls = 0;
+    do
+    {
+        fn();
+        calls++;
+    } while (timer.elapsed() < minMs);
+    return (double)timer.nsecsElapsed()/calls;
+}
+
+static const char *isaName(MonoPacker::Isa isa)
+{
+    switch (isa)
+    {
+    case MonoPacker::AVX2: return "avx2";
+    case MonoPacker::SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+// QPainter composite + dither (the path images still take) against the direct channel
+// threshold-and-pack kernel, over every glyph of a font.
+static bool benchRasterize(const QString &fntFile, int threshold)
+{
+    Converter converter;
+    if (!converter.openFont(fntFile, threshold, 0, 0xFFFF))
+    {
+        fprintf(stderr, "cannot open %s\n", qPrintable(fntFile));
+        return false;
+    }
+
+    // the test fonts keep their glyphs in one page named after the font
+    QString atlasFile = QFileInfo(fntFile).absolutePath()+"/"+QFileInfo(fntFile).baseName()+"_0.png";
+    QImage atlas = QImage(atlasFile).convertToFormat(QImage::Format_ARGB32);
+    if (atlas.isNull())
+    {
+        fprintf(stderr, "cannot open %s\n", qPrintable(atlasFile));
+        return false;
+    }
+
+    QVector<Glyph> glyphs;
+    foreach (const CharInfo *ch, converter.getChars())
+    {
+        if (ch->skip)
+            continue;
+        Glyph glyph;
+        glyph.rect = QRect(ch->attributes.x, ch->attributes.y, ch->attributes.width, ch->attributes.height);
+        glyph.targetWidth = Rasterizer::targetWidth(ch->attributes.width, ch->attributes.xadvance,
+                                                    threshold, glyph.scaled);
+        glyphs.append(glyph);
+    }
+    if (glyphs.isEmpty())
+        return true;
+
+    QString name = QFileInfo(fntFile).baseName();
+    double painterNs = measure([&]() {
+        foreach (const Glyph &g, glyphs)
+        {
+            Rasterizer::packImage(Rasterizer::paint(atlas, g.rect, g.targetWidth, g.scaled));
+        }
+    });
+    printf("%-12s %-8s %10.0f ns/glyph\n", qPrintable(name), "painter", painterNs/glyphs.size());
+
+    for (int isa = MonoPacker::Scalar; isa <= MonoPacker::bestIsa(); isa++)
+    {
+        MonoPacker packer(MonoPacker::Green, 128, true);
+        packer.setIsa((MonoPacker::Isa)isa);
+
+        // both paths must produce the same bits on these (two-level) atlases
+        int mismatches = 0;
+        foreach (const Glyph &g, glyphs)
+        {
+            QByteArray reference = Rasterizer::packImage(Rasterizer::paint(atlas, g.rect, g.targetWidth, g.scaled));
+            if (Rasterizer::pack(atlas, g.rect, g.targetWidth, g.scaled, packer) != reference)
+                mismatches++;
+        }
+
+        double kernelNs = measure([&]() {
+            foreach (const Glyph &g, glyphs)
+            {
+                Rasterizer::pack(atlas, g.rect, g.targetWidth, g.scaled, packer);
+            }
+        });
+        printf("%-12s %-8s %10.0f ns/glyph  %5.1fx  %s\n", qPrintable(name), isaName((MonoPacker::Isa)isa),
+               kernelNs/glyphs.size(), painterNs/kernelNs,
+               mismatches ? qPrintable(QString("%1 glyphs differ").arg(mismatches)) : "identical");
+    }
+    return true;
+}
+
+// Gray level packing of a whole atlas page, scalar against the vector kernel.
+static bool benchGray(const QString &fntFile, int depth)
+{
+    QString atlasFile = QFileInfo(fntFile).absolutePath()+"/"+QFileInfo(fntFile).baseName()+"_0.png";
+    QImage atlas = QImage(atlasFile).convertToFormat(QImage::Format_ARGB32);
+    if (atlas.isNull())
+    {
+        fprintf(stderr, "cannot open %s\n", qPrintable(atlasFile));
+        return false;
+    }
+
+    QString name = QFileInfo(fntFile).baseName();
+    int width = atlas.width()/8*8;
+    QByteArray reference;
+    double scalarNs = 0;
+    for (int isa = MonoPacker::Scalar; isa <= qMin(MonoPacker::bestIsa(), MonoPacker::SSE2); isa++)
+    {
+        MonoPacker packer(MonoPacker::Green, 128, true, false, depth);
+        packer.setIsa((MonoPacker::Isa)isa);
+        QByteArray bitmap(width*depth/8*atlas.height(), 0);
+        double ns = measure([&]() {
+            packer.pack(atlas, QRect(0, 0, width, atlas.height()), (uchar*)bitmap.data(), width, 0);
+        });
+        if (isa == MonoPacker::Scalar)
+        {
+            reference = bitmap;
+            scalarNs = ns;
+        }
+        printf("%-12s %-8s %d bpp %10.0f ns/page  %7.1f MB/s  %5.1fx  %s\n", qPrintable(name),
+               isaName((MonoPacker::Isa)isa), depth, ns, width*atlas.height()*4*1000.0/ns, scalarNs/ns,
+               bitmap == reference ? "identical" : "differs");
+    }
+    return true;
+}
+
+// Dithering of full screen (400x300) images made from the test icons: error diffusion on one
+// thread against all cores, ordered dithering scalar against SSE2.
+static bool benchDither(const QString &iconDir, int depth)
+{
+    QDir dir(iconDir);
+    QVector<QImage> screens;
+    foreach (const QString &file, dir.entryList(QStringList() << "*.png", QDir::Files, QDir::Name))
+    {
+        QImage icon(dir.absoluteFilePath(file));
+        if (!icon.isNull())
+        {
+            screens.append(icon.scaled(400, 300).convertToFormat(QImage::Format_Grayscale8));
+        }
+    }
+    if (screens.isEmpty())
+    {
+        fprintf(stderr, "no images in %s\n", qPrintable(dir.absolutePath()));
+        return false;
+    }
+
+    const char *names[] = { "threshold", "fs", "atkinson", "bayer" };
+    for (int method = Dither::FloydSteinberg; method <= Dither::Bayer; method++)
+    {
+        // variant 0 is the reference: one thread or scalar
+        bool ordered = method == Dither::Bayer;
+        int variants = ordered ? (MonoPacker::bestIsa() >= MonoPacker::SSE2 ? 2 : 1)
+                               : (QThread::idealThreadCount() > 1 ? 2 : 1);
+        QVector<QImage> reference;
+        double referenceNs = 0;
+        for (int variant = 0; variant < variants; variant++)
+        {
+            Dither dither((Dither::Method)method, depth);
+            if (ordered)
+            {
+                dither.setIsa(variant ? MonoPacker::SSE2 : MonoPacker::Scalar);
+            }
+            else
+            {
+                dither.setThreads(variant ? QThread::idealThreadCount() : 1);
+            }
+
+            QVector<QImage> results;
+            foreach (const QImage &screen, screens)
+            {
+                QImage image = screen;
+                dither.apply(image);
+                results.append(image);
+            }
+            if (!variant)
+                reference = results;
+
+            double ns = measure([&]() {
+                foreach (const QImage &screen, screens)
+                {
+                    QImage image = screen;
+                    dither.apply(image);
+                }
+            })/screens.size();
+            if (!variant)
+                referenceNs = ns;
+
+            QString how = ordered ? isaName(variant ? MonoPacker::SSE2 : MonoPacker::Scalar)
+                                  : QString("%1 thr").arg(variant ? QThread::idealThreadCount() : 1);
+            printf("%-9s %-8s %d bpp %10.0f ns/image  %7.1f MB/s  %5.1fx  %s\n", names[method], qPrintable(how),
+                   depth, ns, 400*300*1000.0/ns, referenceNs/ns, results == reference ? "identical" : "differs");
+        }
+    }
+    return true;
+}
+
+// The per-byte QString::sprintf + QTextStream emitter that SourceWriter replaced,
+// kept as the reference for speed and output.
+static void legacyGenerateFont(Converter &converter, const QString &filename, const QString &fontname,
+                               bool bitcount32, const QString &arraySyntax1, const QString &arraySyntax2)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+        return;
+    QTextStream out(&file);
+
+    const QList<CharInfo*> &chars = converter.getChars();
+    const FontInfo *fontInfo = converter.getFontInfo();
+    int minYoffset = INT_MAX;
+    foreach (CharInfo *ch, chars)
+    {
+        if (!ch->skip && ch->yoffset < minYoffset)
+            minYoffset = ch->yoffset;
+    }
+
+    // identical glyphs share the array of the first one, as generateFont() does
+    QMap<QByteArray, int> unique;
+    QMap<int, int> owner;
+    foreach (CharInfo *ch, chars)
+    {
+        if (ch->skip)
+            continue;
+        QByteArray key = QString("%1,%2,%3,").arg(ch->width).arg(ch->height).arg(ch->yoffset-minYoffset).toLatin1() + ch->bitmap;
+        if (!unique.contains(key))
+            unique.insert(key, ch->id);
+        owner.insert(ch->id, unique.value(key));
+    }
+
+    out << "\n";
+    QString lastChar = "";
+    foreach (CharInfo *ch, chars)
+    {
+        if (ch->skip || owner.value(ch->id) != ch->id)
+            continue;
+        out << lastChar;
+        const uchar *data = (const uchar*)ch->bitmap.constData();
+        int byteWidth = ch->width/8;
+        QString lastChar2 = "";
+        if (bitcount32)
+        {
+            int dwordSize = (ch->byteSize+3)/4;
+            QVector<uint> temp(dwordSize);
+            memcpy(temp.data(), data, ch->byteSize);
+            out << "/* '" << (char)ch->id << "' */\n";
+            out << QString(arraySyntax1).arg(QString("char%1").arg(ch->id)).arg(dwordSize+4) << "\n";
+            out << QString("%1,%2,%3,%4,").arg(ch->width).arg(ch->height).arg(dwordSize*4).arg(ch->yoffset-minYoffset) << "\n";
+            for (int i = 0; i < (dwordSize-1); i++)
+                out << QString().sprintf("0x%08X,", temp[i]);
+            if (dwordSize)
+                out << QString().sprintf("0x%08X", temp[dwordSize-1]);
+        }
+        else
+        {
+            out << "/* '" << (char)ch->id << "' */\n";
+            out << QString(arraySyntax1).arg(QString("char%1").arg(ch->id)).arg(ch->byteSize+4) << "\n";
+            out << QString("%1,%2,%3,%4,").arg(ch->width).arg(ch->height).arg(ch->byteSize).arg(ch->yoffset-minYoffset);
+            for (int y = 0; y < ch->height; y++)
+            {
+                out << lastChar2 << "\n";
+                const uchar *line = data + y*byteWidth;
+                for (int x = 0; x < (byteWidth-1); x++)
+                    out << QString().sprintf("0x%02X,", line[x]);
+                out << QString().sprintf("0x%02X", line[byteWidth-1]);
+                lastChar2 = ",";
+            }
+        }
+        out << "};";
+        lastChar = "\n\n";
+    }
+    out << "\n\n\n";
+
+    out << QString(arraySyntax2).arg(fontname).arg(fontInfo->count+2) << "\n";
+    if (bitcount32)
+        out << QString("(unsigned int*)%1,(unsigned int*)%2,\n").arg(fontInfo->first).arg(fontInfo->last);
+    else
+        out << QString("(unsigned char*)%1,(unsigned char*)%2,\n").arg(fontInfo->first).arg(fontInfo->last);
+    lastChar = "";
+    foreach (CharInfo *ch, chars)
+    {
+        out << lastChar;
+        if (ch->skip)
+            out << "0";
+        else
+            out << QString("char%1").arg(owner.value(ch->id));
+        lastChar = ",\n";
+    }
+    out << "};\n";
+}
+
+static QByteArray readFile(const QString &filename)
+{
+    QFile file(filename);
+    file.open(QIODevice::ReadOnly);
+    return file.readAll();
+}
+
+// QString::sprintf per byte against SourceWriter, full generateFont() into a temporary file.
+static bool benchEmit(const QString &fntFile, bool bitcount32)
+{
+    Converter converter;
+    if (!converter.openFont(fntFile, 4, 32, 255))
+    {
+        fprintf(stderr, "cannot open %s\n", qPrintable(fntFile));
+        return false;
+    }
+
+    QTemporaryDir tmpDir;
+    QString legacyFile = tmpDir.path()+"/legacy.c";
+    QString newFile = tmpDir.path()+"/new.c";
+    QString name = QFileInfo(fntFile).baseName();
+    QString syntax1 = bitcount32 ? "static const unsigned int %1[%2] ={" : "static const unsigned char %1[%2] ={";
+    QString syntax2 = bitcount32 ? "const unsigned int *%1[%2] ={" : "const unsigned char *%1[%2] ={";
+
+    // both start from no file, generateFont() skips writing when the file is unchanged
+    double legacyNs = measure([&]() {
+        QFile::remove(legacyFile);
+        legacyGenerateFont(converter, legacyFile, name, bitcount32, syntax1, syntax2);
+    });
+    double newNs = measure([&]() {
+        QFile::remove(newFile);
+        converter.generateFont(newFile, name, "", bitcount32, QImage::Format_Mono, syntax1, syntax2);
+    });
+    QByteArray output = readFile(newFile);
+    bool identical = readFile(legacyFile) == output;
+
+    printf("%-12s %2d bit  sprintf %8.2f ms  writer %8.2f ms  %5.1fx  %7.1f MB/s  %s\n",
+           qPrintable(name), bitcount32 ? 32 : 8, legacyNs/1e6, newNs/1e6, legacyNs/newNs,
+           output.size()/(newNs/1e9)/1e6, identical ? "identical" : "OUTPUT DIFFERS");
+    return identical;
+}
+
+// A rerun of an unchanged font: full openFont() + generateFont() against a cache hit, which
+// hashes the inputs, loads the entry and finds the output file unchanged.
+static bool benchCache(const QString &fntFile)
+{
+    QTemporaryDir tmpDir;
+    QString outFile = tmpDir.path()+"/font.c";
+    QString name = QFileInfo(fntFile).baseName();
+    QString syntax1 = "static const unsigned int %1[%2] ={";
+    QString syntax2 = "const unsigned int *%1[%2] ={";
+    ConversionCache cache(tmpDir.path()+"/cache");
+
+    double convertNs = measure([&]() {
+        Converter converter;
+        converter.openFont(fntFile, 4, 32, 255);
+        converter.generateFont(outFile, name, "", true, QImage::Format_Mono, syntax1, syntax2);
+    });
+    QByteArray output = readFile(outFile);
+    QString settings = "32 msb 4 32-255 "+syntax1+syntax2;
+    cache.store(ConversionCache::key(ConversionCache::fontFiles(fntFile), settings), output);
+
+    bool hit = false;
+    double hitNs = measure([&]() {
+        QByteArray cached;
+        hit = cache.load(ConversionCache::key(ConversionCache::fontFiles(fntFile), settings), &cached) &&
+              Converter::writeFile(outFile, cached, true);
+    });
+
+    printf("%-12s convert %8.2f ms  cache hit %8.3f ms  %6.1fx  %s\n", qPrintable(name),
+           convertNs/1e6, hitNs/1e6, convertNs/hitNs, hit && readFile(outFile) == output ? "identical" : "MISSED");
+    return hit;
+}
+
+// Draws every glyph of a font across a 320x240 display, once on byte columns where Copy is
+// a plain row copy, and once shifted by 3 pixels where rows go through the shifted blit.
+static bool benchBlit(const QString &fntFile)
+{
+    Converter converter;
+    if (!converter.openFont(fntFile, 4, 32, 255))
+    {
+        fprintf(stderr, "cannot open %s\n", qPrintable(fntFile));
+        return false;
+    }
+
+    QVector<uint> codes;
+    foreach (const CharInfo *ch, converter.getChars())
+    {
+        if (!ch->skip)
+            codes.append(ch->id);
+    }
+    if (codes.isEmpty())
+        return true;
+
+    Glcd glcd(320, 240, 1, 1, 0, 0);
+    glcd.setFont(converter.getFontData(glcd.bitmapFormat()));
+
+    QString name = QFileInfo(fntFile).baseName();
+    const char *modeNames[] = { "copy", "or", "xor" };
+    double alignedCopyNs = 0;
+    for (int mode = Glcd::Copy; mode <= Glcd::Xor; mode++)
+    {
+        glcd.setBlitMode((Glcd::BlitMode)mode);
+        for (int shift = 0; shift <= 3; shift += 3)
+        {
+            double ns = measure([&]() {
+                for (int i = 0; i < codes.size(); i++)
+                {
+                    glcd.drawChar((i%32)*8 + shift, 8 + (i/32%4)*48, codes.at(i));
+                }
+            });
+            if (mode == Glcd::Copy && shift == 0)
+                alignedCopyNs = ns;
+            printf("%-12s %-4s x%%8=%d %8.1f ns/glyph  %5.2fx\n", qPrintable(name), modeNames[mode], shift,
+                   ns/codes.size(), ns/alignedCopyNs);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+
+    // fontConverterBench [--suite] [test dir]
+    QStringList args = app.arguments().mid(1);
+    bool suite = args.removeAll("--suite") > 0;
+    QString testDir = args.isEmpty() ? QString(TEST_DATA_DIR) : args.first();
+    if (suite)
+    {
+        return runSuite(testDir);
+    }
+
+    QDir fontDir(testDir+"/fonts");
+    QStringList fonts = fontDir.entryList(QStringList() << "*.fnt", QDir::Files, QDir::Name);
+    if (fonts.isEmpty())
+    {
+        fprintf(stderr, "no fonts in %s\n", qPrintable(fontDir.absolutePath()));
+        return 1;
+    }
+
+    printf("# rasterize: glyph to 1bpp bitmap, threshold 4\n");
+    foreach (const QString &font, fonts)
+    {
+        benchRasterize(fontDir.absoluteFilePath(font), 4);
+    }
+
+    printf("\n# gray: atlas page to 2 and 4 bit gray levels\n");
+    foreach (const QString &font, fonts)
+    {
+        benchGray(fontDir.absoluteFilePath(font), 2);
+        benchGray(fontDir.absoluteFilePath(font), 4);
+    }
+
+    printf("\n# dither: %d test icons scaled to 400x300 grayscale screens\n",
+           QDir(testDir+"/icons").entryList(QStringList() << "*.png", QDir::Files).size());
+    benchDither(testDir+"/icons", 1);
+    benchDither(testDir+"/icons", 2);
+
+    printf("\n# emit: generateFont, chars 32-255\n");
+    foreach (const QString &font, fonts)
+    {
+        benchEmit(fontDir.absoluteFilePath(font), false);
+        benchEmit(fontDir.absoluteFilePath(font), true);
+    }
+
+    printf("\n# cache: rerun of an unchanged font, 32 bit, chars 32-255\n");
+    foreach (const QString &font, fonts)
+    {
+        benchCache(fontDir.absoluteFilePath(font));
+    }
+
+    printf("\n# blit: drawChar on byte columns and shifted, relative to the byte aligned copy\n");
+    foreach (const QString &font, fonts)
+    {
+        benchBlit(fontDir.absoluteFilePath(font));
+    }
+    return 0;
+}
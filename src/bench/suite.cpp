@@ -0,0 +1,182 @@
+#include "suite.h"
+#include "allocationcounter.h"
+#include "converter.h"
+#include "conversioncache.h"
+#include "outputpreset.h"
+#include "glcd.h"
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <stdio.h>
+
+
+static const char sampleText[] = "The quick brown fox jumps over the lazy dog 0123456789";
+
+struct SuiteResult{
+    SuiteResult(){
+        ns = 0;
+        allocs = -1;
+    }
+
+    double ns;          // per op
+    double allocs;      // per op, -1 if not counted
+};
+
+// Runs fn once to warm up (file cache, lazy initialization), then until at least minMs
+// milliseconds have passed.
+template <typename F>
+static SuiteResult runOp(F fn, int minMs = 200)
+{
+    fn();
+    qint64 allocations = AllocationCounter::count();
+    QElapsedTimer timer;
+    timer.start();
+    qint64 ops = 0;
+    do
+    {
+        fn();
+        ops++;
+    } while (timer.elapsed() < minMs);
+
+    SuiteResult result;
+    result.ns = (double)timer.nsecsElapsed()/ops;
+    if (AllocationCounter::isAvailable())
+    {
+        result.allocs = (double)(AllocationCounter::count()-allocations)/ops;
+    }
+    return result;
+}
+
+static void report(const char *benchmark, const QString &input, const SuiteResult &result, qint64 bytesPerOp)
+{
+    printf("%s\t%s\t%.0f\t%.0f\t%.2f\n", benchmark, qPrintable(input), result.ns,
+           bytesPerOp*1e9/result.ns, result.allocs);
+    fflush(stdout);
+}
+
+static qint64 fileBytes(const QStringList &files)
+{
+    qint64 bytes = 0;
+    foreach (const QString &file, files)
+    {
+        bytes += QFileInfo(file).size();
+    }
+    return bytes;
+}
+
+static void benchFont(const QString &fntFile)
+{
+    QString name = QFileInfo(fntFile).baseName();
+
+    // openFont: parse, decode the pages, rasterize chars 32-126; bytes are the files read
+    report("openFont", name, runOp([&]() {
+        Converter converter;
+        converter.openFont(fntFile, 4, 32, 126);
+    }), fileBytes(ConversionCache::fontFiles(fntFile)));
+
+    Converter converter;
+    if (!converter.openFont(fntFile, 4, 32, 126))
+    {
+        fprintf(stderr, "cannot open %s\n", qPrintable(fntFile));
+        return;
+    }
+
+    // generateFont: the whole source file from no file, with the settings of the presets
+    QTemporaryDir tmpDir;
+    QString outFile = tmpDir.path()+"/"+name+".c";
+    const OutputPreset::Id presets[] = { OutputPreset::Generic_8bit, OutputPreset::Generic_32bit };
+    const char *names[] = { "generateFont8", "generateFont32" };
+    for (int i = 0; i < 2; i++)
+    {
+        OutputPreset preset = OutputPreset::get(presets[i]);
+        SuiteResult result = runOp([&]() {
+            QFile::remove(outFile);
+            converter.generateFont(outFile, name, preset.includes, preset.bitcount32, QImage::Format_Mono,
+                                   preset.arraySyntax1, preset.arraySyntax2);
+        });
+        report(names[i], name, result, QFileInfo(outFile).size());
+    }
+
+    // getFontData: the preview font arena, handed to the glcd which releases the one before
+    Glcd glcd(320, 240, 1, 1, 0, 0);
+    report("getFontData", name, runOp([&]() {
+        glcd.setFont(converter.getFontData(glcd.bitmapFormat()));
+    }), converter.getFontInfo()->overallSize);
+
+    // drawStr: one line of text; bytes are the font data read
+    glcd.setFont(converter.getFontData(glcd.bitmapFormat()));
+    glcd.resetCost();
+    glcd.drawStr(0, 0, sampleText);
+    int flashBytes = glcd.getCost().flashBytes;
+    report("drawStr", name, runOp([&]() {
+        glcd.drawStr(0, 0, sampleText);
+    }), flashBytes);
+}
+
+static void benchImages(const QString &iconDir)
+{
+    QDir dir(iconDir);
+    QStringList files;
+    foreach (const QString &file, dir.entryList(QStringList() << "*.png", QDir::Files, QDir::Name))
+    {
+        files.append(dir.absoluteFilePath(file));
+    }
+    if (files.isEmpty())
+    {
+        fprintf(stderr, "no images in %s\n", qPrintable(dir.absolutePath()));
+        return;
+    }
+
+    // openImage: the whole icon set per op
+    report("openImage", QString("icons/%1").arg(files.size()), runOp([&]() {
+        Converter converter;
+        foreach (const QString &file, files)
+        {
+            converter.openImage(file, 4);
+        }
+    }), fileBytes(files));
+}
+
+// renderMem: a full 320x240 frame per op in each framebuffer layout; bytes are the preview
+// image written, at one screen pixel per display pixel.
+static void benchRender()
+{
+    const Glcd::Layout layouts[] = { Glcd::RowsMsbFirst, Glcd::VerticalPages, Glcd::Gray4Rows };
+    const char *names[] = { "rows", "pages", "gray4" };
+    for (int i = 0; i < 3; i++)
+    {
+        Glcd glcd(320, 240, 1, 1, 0, 0, layouts[i]);
+        uchar fill = 0;
+        SuiteResult result = runOp([&]() {
+            fill ^= 0x5A;
+            glcd.fillMem(fill);
+            glcd.renderMem();
+        });
+        report("renderMem", names[i], result, glcd.getImage().sizeInBytes());
+    }
+}
+
+int runSuite(const QString &testDir)
+{
+    QDir fontDir(testDir+"/fonts");
+    QStringList fonts = fontDir.entryList(QStringList() << "*.fnt", QDir::Files, QDir::Name);
+    if (fonts.isEmpty())
+    {
+        fprintf(stderr, "no fonts in %s\n", qPrintable(fontDir.absolutePath()));
+        return 1;
+    }
+
+    printf("# fontConverterBench suite, Qt %s, allocations %s\n", qVersion(),
+           AllocationCounter::isAvailable() ? "counted" : "not counted");
+    printf("benchmark\tinput\tns/op\tbytes/s\tallocs/op\n");
+    foreach (const QString &font, fonts)
+    {
+        benchFont(fontDir.absoluteFilePath(font));
+    }
+    benchImages(testDir+"/icons");
+    benchRender();
+    return 0;
+}
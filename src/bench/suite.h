@@ -0,0 +1,12 @@
+#ifndef SUITE_H
+#define SUITE_H
+
+#include <QString>
+
+// Micro-benchmarks of the conversion and preview entry points over the fonts and icons in
+// testDir, printed as tab separated lines for comparing runs across Qt versions and settings:
+// benchmark, input, ns/op, bytes/s, allocs/op (-1 where allocations cannot be counted).
+int runSuite(const QString &testDir);
+
+
+#endif // SUITE_H
@@ -0,0 +1,205 @@
+#include "bitmapblob.h"
+#include <QHash>
+#include <QtEndian>
+#include <string.h>
+
+
+static const char blobMagic[4] = { 'F', 'C', 'B', 'F' };
+static const int blobVersion = 1;
+
+
+BitmapBlob::BitmapBlob():
+    data(NULL), size(0), first_(0), count_(0)
+{
+}
+
+BitmapBlob::~BitmapBlob()
+{
+    close();
+}
+
+bool BitmapBlob::open(const QString &filename)
+{
+    close();
+
+    file.setFileName(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    size = file.size();
+    data = file.map(0, size);
+    if (!data || !validate())
+    {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void BitmapBlob::close()
+{
+    if (data)
+    {
+        file.unmap((uchar*)data);
+    }
+    file.close();
+    data = NULL;
+    size = 0;
+    first_ = 0;
+    count_ = 0;
+}
+
+bool BitmapBlob::validate()
+{
+    if (size < headerSize || memcmp(data, blobMagic, 4) != 0 || data[4] != blobVersion)
+    {
+        return false;
+    }
+    first_ = qFromLittleEndian<quint32>(data+8);
+    count_ = qFromLittleEndian<quint32>(data+12);
+    return count_ >= 0 && headerSize + (qint64)count_*entrySize() <= size;
+}
+
+// Offset of the record for a code point, 0 if there is none.
+qint64 BitmapBlob::recordOffset(int code) const
+{
+    if (!data)
+    {
+        return 0;
+    }
+
+    const uchar *table = data + headerSize;
+    if (!(data[6] & Sparse))
+    {
+        int index = code - first_;
+        if (index < 0 || index >= count_)
+        {
+            return 0;
+        }
+        return qFromLittleEndian<quint32>(table + index*4);
+    }
+
+    int lo = 0;
+    int hi = count_;
+    while (lo < hi)
+    {
+        int mid = (lo+hi)/2;
+        if ((int)qFromLittleEndian<quint32>(table + mid*8) < code)
+        {
+            lo = mid+1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo < count_ && (int)qFromLittleEndian<quint32>(table + lo*8) == code)
+    {
+        return qFromLittleEndian<quint32>(table + lo*8 + 4);
+    }
+    return 0;
+}
+
+bool BitmapBlob::contains(int code) const
+{
+    return recordOffset(code) != 0;
+}
+
+bool BitmapBlob::glyph(int code, Glyph *glyph) const
+{
+    qint64 offset = recordOffset(code);
+    if (!offset || offset + recordHeaderSize > size)
+    {
+        return false;
+    }
+
+    const uchar *record = data + offset;
+    glyph->width = qFromLittleEndian<quint16>(record);
+    glyph->height = qFromLittleEndian<quint16>(record+2);
+    glyph->yoffset = qFromLittleEndian<qint16>(record+4);
+    glyph->flags = record[6];
+    glyph->bitmap = record + recordHeaderSize;
+    glyph->available = size - offset - recordHeaderSize;
+    if (glyph->flags & RleEncoded)
+    {
+        return true;
+    }
+    return (qint64)glyph->width*depth()/8*glyph->height <= glyph->available;
+}
+
+static void appendLE16(QByteArray &blob, int value)
+{
+    uchar bytes[2];
+    qToLittleEndian<quint16>(value, bytes);
+    blob.append((const char*)bytes, 2);
+}
+
+static void appendLE32(QByteArray &blob, quint32 value)
+{
+    uchar bytes[4];
+    qToLittleEndian<quint32>(value, bytes);
+    blob.append((const char*)bytes, 4);
+}
+
+QByteArray BitmapBlob::build(Type type, int first, const QList<Record> &records, int flags)
+{
+    int align = (flags & Aligned32) ? 4 : 1;
+
+    QByteArray blob;
+    blob.append(blobMagic, 4);
+    blob.append((char)blobVersion);
+    blob.append((char)type);
+    blob.append((char)flags);
+    blob.append((char)0);
+    appendLE32(blob, first);
+    appendLE32(blob, records.size());
+
+    // offsets are known once the records are laid out
+    int entrySize = (flags & Sparse) ? 8 : 4;
+    int tableOffset = blob.size();
+    blob.append(QByteArray(records.size()*entrySize, 0));
+
+    // identical records are stored once, their offsets point to the same copy
+    QHash<QByteArray, quint32> stored;
+    for (int i = 0; i < records.size(); i++)
+    {
+        const Record &record = records.at(i);
+        if (!record.present)
+        {
+            continue;
+        }
+
+        QByteArray bytes;
+        appendLE16(bytes, record.width);
+        appendLE16(bytes, record.height);
+        appendLE16(bytes, (quint16)(qint16)record.yoffset);
+        bytes.append((char)record.flags);
+        bytes.append((char)0);
+        bytes.append(record.bitmap);
+
+        quint32 offset = stored.value(bytes, 0);
+        if (!offset)
+        {
+            while (blob.size() % align)
+            {
+                blob.append((char)0);
+            }
+            offset = blob.size();
+            stored.insert(bytes, offset);
+            blob.append(bytes);
+        }
+        uchar *entry = (uchar*)blob.data() + tableOffset + i*entrySize;
+        if (flags & Sparse)
+        {
+            qToLittleEndian<quint32>(record.code, entry);
+            entry += 4;
+        }
+        qToLittleEndian<quint32>(offset, entry);
+    }
+    while (blob.size() % align)
+    {
+        blob.append((char)0);
+    }
+    return blob;
+}
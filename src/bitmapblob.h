@@ -0,0 +1,100 @@
+#ifndef BITMAPBLOB_H
+#define BITMAPBLOB_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QString>
+
+// Binary container for font glyphs or images, meant to be mapped straight from
+// (SPI) flash. All values are little endian, offsets count from the start of the blob.
+//
+//  0  char[4] magic "FCBF"
+//  4  u8      version (1)
+//  5  u8      type, 0 = font, 1 = images
+//  6  u8      flags, bit 0 = records aligned to 32 bits, bit 1 = LSB first bitmaps, bit 2 = sparse table,
+//             bit 3 = 2 bit gray bitmaps, bit 4 = 4 bit gray bitmaps
+//  7  u8      reserved
+//  8  u32     first code point (images: 0)
+// 12  u32     count of entries in the offset table
+// 16  u32     offset[count], 0 = no glyph for this code point; identical records are stored once
+//     sparse: {u32 code, u32 offset}[count] sorted by code, only for the glyphs the font has
+//
+// Every record is an 8 byte header followed by the bitmap rows (width*depth/8 bytes each):
+//  0  u16     width
+//  2  u16     height
+//  4  i16     yoffset
+//  6  u8      record flags, bit 0 = bitmap is run-length encoded (see Rle)
+//  7  u8      reserved
+class BitmapBlob
+{
+public:
+    enum Type{
+        Font = 0, Images
+    };
+    enum Flags{
+        Aligned32 = 0x01, LsbFirst = 0x02, Sparse = 0x04, Gray2 = 0x08, Gray4 = 0x10
+    };
+    enum RecordFlags{
+        RleEncoded = 0x01
+    };
+
+    struct Record{
+        Record(){
+            present = false;
+            width = 0;
+            height = 0;
+            yoffset = 0;
+            flags = 0;
+            code = 0;
+        }
+        bool present;
+        int code;           // sparse tables only
+        int width, height, yoffset;
+        int flags;          // RecordFlags
+        QByteArray bitmap;
+    };
+
+    struct Glyph{
+        int width, height, yoffset;
+        int flags;
+        const uchar *bitmap;
+        int available;      // bytes from bitmap to the end of the blob
+    };
+
+    static const int headerSize = 16;
+    static const int recordHeaderSize = 8;
+
+    BitmapBlob();
+    ~BitmapBlob();
+
+    // Maps the file into memory, nothing is copied.
+    bool open(const QString &filename);
+    void close();
+
+    bool isValid() const { return data != NULL; }
+    Type type() const { return (Type)data[5]; }
+    int flags() const { return data[6]; }
+    int depth() const { return (data[6] & Gray4) ? 4 : (data[6] & Gray2) ? 2 : 1; }
+    int first() const { return first_; }
+    int count() const { return count_; }
+
+    // Looks up the glyph for a code point (fonts) or an index (images).
+    bool glyph(int code, Glyph *glyph) const;
+    bool contains(int code) const;
+
+    static QByteArray build(Type type, int first, const QList<Record> &records, int flags);
+
+private:
+    bool validate();
+    qint64 recordOffset(int code) const;
+    int entrySize() const { return (data[6] & Sparse) ? 8 : 4; }
+
+    QFile file;
+    const uchar *data;
+    qint64 size;
+    int first_, count_;
+};
+
+
+#endif // BITMAPBLOB_H
@@ -0,0 +1,375 @@
+#include "bmfont.h"
+#include <QByteArray>
+#include <QFile>
+#include <QXmlStreamReader>
+#include <QtEndian>
+#include <string.h>
+#include <stdlib.h>
+
+
+enum Tag{
+    OtherTag, InfoTag, CommonTag, PageTag, CharTag, KerningTag
+};
+
+static const struct { const char *name; Tag tag; } tagNames[] = {
+    { "info", InfoTag }, { "common", CommonTag }, { "page", PageTag },
+    { "char", CharTag }, { "kerning", KerningTag }
+};
+static const int tagCount = sizeof(tagNames)/sizeof(tagNames[0]);
+
+static Tag tagFromName(const char *name, int length)
+{
+    for (int i = 0; i < tagCount; i++)
+    {
+        if ((int)strlen(tagNames[i].name) == length && !memcmp(tagNames[i].name, name, length))
+        {
+            return tagNames[i].tag;
+        }
+    }
+    return OtherTag;
+}
+
+static Tag tagFromName(const QStringRef &name)
+{
+    for (int i = 0; i < tagCount; i++)
+    {
+        if (name == QLatin1String(tagNames[i].name))
+        {
+            return tagNames[i].tag;
+        }
+    }
+    return OtherTag;
+}
+
+// Attributes of an XML element.
+class XmlAttributes
+{
+public:
+    explicit XmlAttributes(const QXmlStreamAttributes &attributes):
+        attributes(attributes)
+    {
+    }
+
+    int integer(const char *key, int defaultValue = 0) const
+    {
+        QStringRef value = attributes.value(QLatin1String(key));
+        return value.isNull() ? defaultValue : value.toInt();
+    }
+
+    QString string(const char *key) const
+    {
+        return attributes.value(QLatin1String(key)).toString();
+    }
+
+private:
+    const QXmlStreamAttributes &attributes;
+};
+
+// Attributes of a line of the text format: key=value pairs, values may be quoted.
+// The keys and values point into the line, nothing is copied.
+class TextAttributes
+{
+public:
+    TextAttributes():
+        count(0)
+    {
+    }
+
+    // Splits the line into its tag and attributes, returns the tag.
+    Tag parse(const char *p, const char *end)
+    {
+        count = 0;
+        while (p < end && isSpace(*p))
+            p++;
+        const char *tag = p;
+        while (p < end && !isSpace(*p))
+            p++;
+        Tag result = tagFromName(tag, p-tag);
+
+        while (p < end && count < maxAttributes)
+        {
+            while (p < end && isSpace(*p))
+                p++;
+            const char *key = p;
+            while (p < end && *p != '=' && !isSpace(*p))
+                p++;
+            if (p >= end || *p != '=')
+                break;
+            Attribute &attr = attrs[count++];
+            attr.key = key;
+            attr.keyLength = p-key;
+            p++;
+            if (p < end && *p == '"')
+            {
+                attr.value = ++p;
+                while (p < end && *p != '"')
+                    p++;
+                attr.valueLength = p-attr.value;
+                if (p < end)
+                    p++;
+            }
+            else
+            {
+                attr.value = p;
+                while (p < end && !isSpace(*p))
+                    p++;
+                attr.valueLength = p-attr.value;
+            }
+        }
+        return result;
+    }
+
+    int integer(const char *key, int defaultValue = 0) const
+    {
+        const Attribute *attr = find(key);
+        if (!attr)
+        {
+            return defaultValue;
+        }
+        char buffer[16];
+        int length = qMin(attr->valueLength, (int)sizeof(buffer)-1);
+        memcpy(buffer, attr->value, length);
+        buffer[length] = 0;
+        return atoi(buffer);
+    }
+
+    QString string(const char *key) const
+    {
+        const Attribute *attr = find(key);
+        return attr ? QString::fromUtf8(attr->value, attr->valueLength) : QString();
+    }
+
+private:
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+    struct Attribute{
+        const char *key;
+        int keyLength;
+        const char *value;
+        int valueLength;
+    };
+
+    const Attribute *find(const char *key) const
+    {
+        int keyLength = strlen(key);
+        for (int i = 0; i < count; i++)
+        {
+            if (attrs[i].keyLength == keyLength && !memcmp(attrs[i].key, key, keyLength))
+            {
+                return &attrs[i];
+            }
+        }
+        return NULL;
+    }
+
+    static const int maxAttributes = 24;
+    Attribute attrs[maxAttributes];
+    int count;
+};
+
+template <typename Attributes>
+static void readElement(BMFont *font, Tag tag, const Attributes &attrs)
+{
+    switch (tag)
+    {
+    case InfoTag:
+        font->face = attrs.string("face");
+        font->size = attrs.integer("size");
+        font->stretchH = attrs.integer("stretchH");
+        break;
+    case CommonTag:
+        font->lineHeight = attrs.integer("lineHeight");
+        font->base = attrs.integer("base");
+        font->alphaChnl = attrs.integer("alphaChnl", 4);
+        font->redChnl = attrs.integer("redChnl");
+        font->greenChnl = attrs.integer("greenChnl");
+        font->blueChnl = attrs.integer("blueChnl");
+        break;
+    case PageTag:
+        font->pages.insert(attrs.integer("id"), attrs.string("file"));
+        break;
+    case CharTag:
+    {
+        BMFontChar ch;
+        ch.id = attrs.integer("id");
+        ch.x = attrs.integer("x");
+        ch.y = attrs.integer("y");
+        ch.width = attrs.integer("width");
+        ch.height = attrs.integer("height");
+        ch.xoffset = attrs.integer("xoffset");
+        ch.yoffset = attrs.integer("yoffset");
+        ch.xadvance = attrs.integer("xadvance");
+        ch.page = attrs.integer("page");
+        font->chars.append(ch);
+        break;
+    }
+    case KerningTag:
+    {
+        BMFontKerning kerning;
+        kerning.first = attrs.integer("first");
+        kerning.second = attrs.integer("second");
+        kerning.amount = attrs.integer("amount");
+        font->kernings.append(kerning);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static bool loadXml(BMFont *font, QIODevice *device)
+{
+    QXmlStreamReader reader(device);
+    if (!reader.readNextStartElement() || reader.name() != QLatin1String("font"))
+    {
+        return false;
+    }
+    while (!reader.atEnd())
+    {
+        if (reader.readNext() == QXmlStreamReader::StartElement)
+        {
+            readElement(font, tagFromName(reader.name()), XmlAttributes(reader.attributes()));
+        }
+    }
+    return !reader.hasError();
+}
+
+static bool loadText(BMFont *font, QIODevice *device)
+{
+    TextAttributes attrs;
+    bool hasInfo = false;
+    while (!device->atEnd())
+    {
+        QByteArray line = device->readLine();
+        Tag tag = attrs.parse(line.constData(), line.constData()+line.size());
+        hasInfo |= tag == InfoTag || tag == CommonTag;
+        readElement(font, tag, attrs);
+    }
+    return hasInfo;
+}
+
+// Binary format version 3: "BMF", version byte, then blocks of a type byte, a 32 bit size and the data.
+static bool loadBinary(BMFont *font, const QByteArray &data)
+{
+    const uchar *p = (const uchar*)data.constData();
+    const uchar *end = p + data.size();
+    if (data.size() < 4 || p[3] != 3)
+    {
+        return false;
+    }
+    p += 4;
+
+    while (end-p >= 5)
+    {
+        int type = p[0];
+        qint64 size = qFromLittleEndian<quint32>(p+1);
+        p += 5;
+        if (size > end-p)
+        {
+            return false;
+        }
+        const uchar *block = p;
+        p += size;
+
+        switch (type)
+        {
+        case 1:     // info
+            if (size >= 14)
+            {
+                font->size = qAbs(qFromLittleEndian<qint16>(block));
+                font->stretchH = qFromLittleEndian<quint16>(block+4);
+                font->face = QString::fromUtf8((const char*)block+14, qstrnlen((const char*)block+14, size-14));
+            }
+            break;
+        case 2:     // common
+            if (size >= 15)
+            {
+                font->lineHeight = qFromLittleEndian<quint16>(block);
+                font->base = qFromLittleEndian<quint16>(block+2);
+                font->alphaChnl = block[11];
+                font->redChnl = block[12];
+                font->greenChnl = block[13];
+                font->blueChnl = block[14];
+            }
+            break;
+        case 3:     // pages, zero terminated names of equal length
+        {
+            int id = 0;
+            for (qint64 pos = 0; pos < size; id++)
+            {
+                int length = qstrnlen((const char*)block+pos, size-pos);
+                font->pages.insert(id, QString::fromUtf8((const char*)block+pos, length));
+                pos += length+1;
+            }
+            break;
+        }
+        case 4:     // chars, 20 bytes each
+            font->chars.reserve(size/20);
+            for (const uchar *c = block; c+20 <= block+size; c += 20)
+            {
+                BMFontChar ch;
+                ch.id = qFromLittleEndian<quint32>(c);
+                ch.x = qFromLittleEndian<quint16>(c+4);
+                ch.y = qFromLittleEndian<quint16>(c+6);
+                ch.width = qFromLittleEndian<quint16>(c+8);
+                ch.height = qFromLittleEndian<quint16>(c+10);
+                ch.xoffset = qFromLittleEndian<qint16>(c+12);
+                ch.yoffset = qFromLittleEndian<qint16>(c+14);
+                ch.xadvance = qFromLittleEndian<qint16>(c+16);
+                ch.page = c[18];
+                font->chars.append(ch);
+            }
+            break;
+        case 5:     // kerning pairs, 10 bytes each
+            font->kernings.reserve(size/10);
+            for (const uchar *k = block; k+10 <= block+size; k += 10)
+            {
+                BMFontKerning kerning;
+                kerning.first = qFromLittleEndian<quint32>(k);
+                kerning.second = qFromLittleEndian<quint32>(k+4);
+                kerning.amount = qFromLittleEndian<qint16>(k+8);
+                font->kernings.append(kerning);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+bool BMFont::load(const QString &filename)
+{
+    *this = BMFont();
+
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+
+    QByteArray start = file.peek(64);
+    bool ok;
+    if (start.startsWith("BMF"))
+    {
+        format = Binary;
+        ok = loadBinary(this, file.readAll());
+    }
+    else if (start.trimmed().startsWith("<") || start.startsWith("\xEF\xBB\xBF<"))
+    {
+        format = Xml;
+        ok = loadXml(this, &file);
+    }
+    else
+    {
+        format = Text;
+        ok = loadText(this, &file);
+    }
+    file.close();
+
+    if (!ok)
+    {
+        format = Invalid;
+    }
+    return ok;
+}
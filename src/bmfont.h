@@ -0,0 +1,69 @@
+#ifndef BMFONT_H
+#define BMFONT_H
+
+#include <QString>
+#include <QMap>
+#include <QVector>
+
+struct BMFontChar{
+    BMFontChar(){
+        id = 0;
+        x = 0;
+        y = 0;
+        width = 0;
+        height = 0;
+        xoffset = 0;
+        yoffset = 0;
+        xadvance = 0;
+        page = 0;
+    }
+
+    int id;
+    int x, y, width, height;
+    int xoffset, yoffset, xadvance;
+    int page;
+};
+
+struct BMFontKerning{
+    BMFontKerning(){
+        first = 0;
+        second = 0;
+        amount = 0;
+    }
+
+    int first, second, amount;
+};
+
+// Font descriptor written by BMFont, read in a single pass from any of its three formats:
+// XML, text and binary (version 3).
+struct BMFont{
+    enum Format{
+        Invalid = 0, Xml, Text, Binary
+    };
+
+    BMFont(){
+        format = Invalid;
+        size = 0;
+        stretchH = 0;
+        lineHeight = 0;
+        base = 0;
+        alphaChnl = 4;
+        redChnl = 0;
+        greenChnl = 0;
+        blueChnl = 0;
+    }
+
+    bool load(const QString &filename);
+
+    Format format;
+    QString face;
+    int size, stretchH;
+    int lineHeight, base;
+    int alphaChnl, redChnl, greenChnl, blueChnl;
+    QMap<int, QString> pages;   // page id -> image file name relative to the .fnt file
+    QVector<BMFontChar> chars;  // in file order
+    QVector<BMFontKerning> kernings;
+};
+
+
+#endif // BMFONT_H
@@ -0,0 +1,16 @@
+#-------------------------------------------------
+#
+# Headless command-line converter
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+TARGET = fontConverterCli
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+
+include(../converter.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,633 @@
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QStandardPaths>
+#include <QMutex>
+#include <QMap>
+#include <QThread>
+#include <QThreadPool>
+#include <QTextStream>
+#include <QtConcurrent>
+#include "converter.h"
+#include "conversioncache.h"
+#include "sourcewatcher.h"
+#include "outputpreset.h"
+
+
+struct Settings{
+    Settings(){
+        bitcount32 = true;
+        binary = false;
+        rle = false;
+        sparse = false;
+        kerning = false;
+        packed = false;
+        format = QImage::Format_Mono;
+        depth = 1;
+        dither = Dither::Threshold;
+        threshold = 4;
+        cutoff = 128;
+        firstChar = 32;
+        lastChar = 126;
+        cacheSize = 64*1024*1024;
+    }
+
+    QString includes;
+    QString arraySyntax1;
+    QString arraySyntax2;
+    bool bitcount32;
+    bool binary;        // write a BitmapBlob instead of C source
+    bool rle;
+    bool sparse;
+    bool kerning;
+    bool packed;        // one array with a 16 bit offset table
+    QImage::Format format;
+    int depth;          // bits per pixel, 2 and 4 are gray levels
+    Dither::Method dither;  // images only
+    int threshold;
+    int cutoff;
+    int firstChar, lastChar;
+    QString outputDir;
+    QString cacheDir;   // empty: no cache
+    qint64 cacheSize;   // bytes the cache may take after the run
+};
+
+struct Job{
+    Job(){
+        isFont = false;
+    }
+
+    QString name;       // font name or image set name, also the output basename
+    QStringList files;  // one .fnt file or any number of image files
+    bool isFont;
+};
+
+
+static QMutex outputMutex;
+
+static void printOut(const QString &text)
+{
+    QMutexLocker locker(&outputMutex);
+    static QTextStream stream(stdout);
+    stream << text << '\n';
+    stream.flush();
+}
+
+static void printErr(const QString &text)
+{
+    QMutexLocker locker(&outputMutex);
+    static QTextStream stream(stderr);
+    stream << text << '\n';
+    stream.flush();
+}
+
+static bool isImageFile(const QString &filename)
+{
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    return suffix == "png" || suffix == "bmp" || suffix == "jpg";
+}
+
+// Everything besides the input files that the output depends on. The converter build is in it
+// too, so entries of an older converter are not used.
+static QString cacheSettings(const Job &job, const Settings &settings)
+{
+    QStringList fields;
+    fields << QFileInfo(QCoreApplication::applicationFilePath()).lastModified().toString(Qt::ISODate)
+           << job.name
+           << QString::number(job.isFont)
+           << QString::number(settings.bitcount32)
+           << QString::number(settings.binary)
+           << QString::number(settings.rle)
+           << QString::number(settings.sparse)
+           << QString::number(settings.kerning)
+           << QString::number(settings.packed)
+           << QString::number(settings.format)
+           << QString::number(settings.depth)
+           << QString::number(settings.dither)
+           << QString::number(settings.threshold)
+           << QString::number(settings.cutoff)
+           << QString::number(settings.firstChar)
+           << QString::number(settings.lastChar)
+           << settings.includes
+           << settings.arraySyntax1
+           << settings.arraySyntax2;
+    return fields.join(QChar(0));
+}
+
+static QString outputFile(const Job &job, const Settings &settings)
+{
+    QString outDir = settings.outputDir;
+    if (outDir.isEmpty())
+    {
+        outDir = QFileInfo(job.files.first()).absolutePath();
+    }
+    return outDir + "/" + job.name + (settings.binary ? ".bin" : ".c");
+}
+
+static bool openJob(Converter &converter, const Job &job, const Settings &settings)
+{
+    converter.setCutoff(settings.cutoff);
+    converter.setRleCompression(settings.rle);
+    converter.setSparse(settings.sparse);
+    converter.setKerning(settings.kerning);
+    converter.setPacked(settings.packed);
+    converter.setDepth(settings.depth);
+    converter.setDither(settings.dither);
+    if (job.isFont)
+    {
+        if (!converter.openFont(job.files.first(), settings.threshold,
+                                settings.firstChar, settings.lastChar))
+        {
+            printErr("Cannot open font " + QDir::toNativeSeparators(job.files.first()));
+            return false;
+        }
+        return true;
+    }
+
+    foreach (const QString &imgFile, job.files)
+    {
+        if (!converter.openImage(imgFile, settings.threshold))
+        {
+            printErr("Cannot open image " + QDir::toNativeSeparators(imgFile));
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool writeJob(Converter &converter, const Job &job, const Settings &settings, const QString &filename)
+{
+    bool ok;
+    if (job.isFont && settings.binary)
+    {
+        ok = converter.generateFontBlob(filename, settings.bitcount32, settings.format);
+    }
+    else if (job.isFont)
+    {
+        ok = converter.generateFont(filename, job.name,
+                                    settings.includes, settings.bitcount32, settings.format,
+                                    settings.arraySyntax1, settings.arraySyntax2);
+    }
+    else if (settings.binary)
+    {
+        ok = converter.generateImagesBlob(filename, settings.bitcount32, settings.format);
+    }
+    else
+    {
+        ok = converter.generateImages(filename,
+                                      settings.includes, settings.bitcount32, settings.format,
+                                      settings.arraySyntax1);
+    }
+
+    if (!ok)
+    {
+        printErr("Cannot write " + QDir::toNativeSeparators(filename));
+        return false;
+    }
+    printOut(QDir::toNativeSeparators(filename));
+    return true;
+}
+
+static bool runJob(const Job &job, const Settings &settings)
+{
+    QString filename = outputFile(job, settings);
+
+    // an unchanged job only costs hashing its inputs
+    ConversionCache cache(settings.cacheDir);
+    QByteArray key;
+    if (!settings.cacheDir.isEmpty())
+    {
+        QStringList inputs = job.isFont ? ConversionCache::fontFiles(job.files.first()) : job.files;
+        key = inputs.isEmpty() ? QByteArray() : ConversionCache::key(inputs, cacheSettings(job, settings));
+        QByteArray output;
+        if (cache.load(key, &output))
+        {
+            if (!Converter::writeFile(filename, output, !settings.binary))
+            {
+                printErr("Cannot write " + QDir::toNativeSeparators(filename));
+                return false;
+            }
+            printOut(QDir::toNativeSeparators(filename));
+            return true;
+        }
+    }
+
+    Converter converter;
+    if (!openJob(converter, job, settings) || !writeJob(converter, job, settings, filename))
+    {
+        return false;
+    }
+    if (!key.isEmpty())
+    {
+        QFile file(filename);
+        if (file.open(QIODevice::ReadOnly | (settings.binary ? QIODevice::NotOpen : QIODevice::Text)))
+        {
+            cache.store(key, file.readAll());
+        }
+    }
+    return true;
+}
+
+struct RunJob{
+    typedef bool result_type;
+
+    RunJob(const Settings &settings):
+        settings(settings)
+    {
+    }
+
+    bool operator()(const Job &job) const
+    {
+        return runJob(job, settings);
+    }
+
+    const Settings &settings;
+};
+
+
+// Watch mode keeps the converter of every job open, so a changed file only regenerates the
+// glyphs or images made from it before the output is written again.
+struct WatchedJob{
+    Job job;
+    QString filename;
+    Converter converter;
+    SourceWatcher watcher;
+};
+
+struct OpenWatchedJob{
+    typedef bool result_type;
+
+    OpenWatchedJob(const Settings &settings):
+        settings(settings)
+    {
+    }
+
+    bool operator()(WatchedJob *watched) const
+    {
+        return openJob(watched->converter, watched->job, settings) &&
+               writeJob(watched->converter, watched->job, settings, watched->filename);
+    }
+
+    const Settings &settings;
+};
+
+static void updateWatchedJob(WatchedJob *watched, const QStringList &files, const Settings &settings)
+{
+    Converter &converter = watched->converter;
+    const Job &job = watched->job;
+    bool ok;
+    if (job.isFont ? converter.getFontFiles().isEmpty() : converter.getImgFiles().size() != job.files.size())
+    {
+        // the job could not be opened before, the new files may fix that
+        converter.clearImages();
+        ok = openJob(converter, job, settings);
+    }
+    else
+    {
+        if (job.isFont)
+        {
+            converter.reloadFontFiles(files, &ok);
+        }
+        else
+        {
+            converter.reloadImages(files, settings.threshold, &ok);
+        }
+        if (!ok)
+        {
+            printErr("Cannot read " + QDir::toNativeSeparators(files.join(", ")));
+        }
+    }
+    if (job.isFont && !converter.getFontFiles().isEmpty())
+    {
+        // a changed .fnt may use other pages
+        watched->watcher.setFiles(converter.getFontFiles());
+    }
+    if (ok)
+    {
+        writeJob(converter, job, settings, watched->filename);
+    }
+}
+
+static int watchJobs(QGuiApplication &app, const QList<Job> &jobs, const Settings &settings)
+{
+    QList<WatchedJob*> watchedJobs;
+    foreach (const Job &job, jobs)
+    {
+        WatchedJob *watched = new WatchedJob;
+        watched->job = job;
+        watched->filename = outputFile(job, settings);
+        watchedJobs.append(watched);
+    }
+    QtConcurrent::blockingMap(watchedJobs, OpenWatchedJob(settings));
+
+    foreach (WatchedJob *watched, watchedJobs)
+    {
+        // a job that failed to open is watched too, it is opened again once its files change
+        QStringList files = watched->job.isFont ? ConversionCache::fontFiles(watched->job.files.first())
+                                                : watched->job.files;
+        watched->watcher.setFiles(files.isEmpty() ? watched->job.files : files);
+        QObject::connect(&watched->watcher, &SourceWatcher::filesChanged, [watched, &settings](const QStringList &changed) {
+            updateWatchedJob(watched, changed, settings);
+        });
+    }
+    printOut("Watching for changes, press Ctrl+C to stop");
+    int result = app.exec();
+    qDeleteAll(watchedJobs);
+    return result;
+}
+
+// Two jobs with the same name, like a/foo.fnt and b/foo.fnt, would overwrite
+// each other's output, and a job without a name would write a hidden ".c" file,
+// so they are rejected up front.
+static bool checkOutputFiles(const QList<Job> &jobs, const Settings &settings)
+{
+    QMap<QString, QString> owners;
+    foreach (const Job &job, jobs)
+    {
+        QString filename = QFileInfo(outputFile(job, settings)).absoluteFilePath();
+        QString source = job.isFont ? job.files.first() : job.name;
+        if (job.name.isEmpty())
+        {
+            printErr("The job of " + QDir::toNativeSeparators(job.files.first()) + " has no name for its output file");
+            return false;
+        }
+        if (owners.contains(filename))
+        {
+            printErr("Jobs " + QDir::toNativeSeparators(owners.value(filename)) + " and " + QDir::toNativeSeparators(source)
+                     + " both write " + QDir::toNativeSeparators(filename));
+            return false;
+        }
+        owners.insert(filename, source);
+    }
+    return true;
+}
+
+static QList<Job> collectJobs(const QStringList &inputs, const QString &imagesName)
+{
+    QList<Job> jobs;
+    Job looseImages;
+    looseImages.name = imagesName;
+
+    foreach (const QString &input, inputs)
+    {
+        QFileInfo info(input);
+        if (info.isDir())
+        {
+            Job imageSet;
+            // "icons/" has no file name, the directory name is the set name
+            imageSet.name = QDir(info.absoluteFilePath()).dirName();
+            QDir dir(info.absoluteFilePath());
+            QStringList filters;
+            filters << "*.png" << "*.bmp" << "*.jpg";
+            foreach (const QString &entry, dir.entryList(filters, QDir::Files, QDir::Name))
+            {
+                imageSet.files.append(dir.absoluteFilePath(entry));
+            }
+            if (!imageSet.files.isEmpty())
+            {
+                jobs.append(imageSet);
+            }
+        }
+        else if (info.suffix().toLower() == "fnt")
+        {
+            Job font;
+            font.name = info.baseName();
+            font.files.append(info.absoluteFilePath());
+            font.isFont = true;
+            jobs.append(font);
+        }
+        else if (isImageFile(input))
+        {
+            looseImages.files.append(info.absoluteFilePath());
+        }
+        else
+        {
+            printErr("Skipping " + QDir::toNativeSeparators(input));
+        }
+    }
+
+    if (!looseImages.files.isEmpty())
+    {
+        jobs.append(looseImages);
+    }
+    return jobs;
+}
+
+int main(int argc, char *argv[])
+{
+    // QPainter needs a GUI application, but there is no display on a build server
+    if (qgetenv("QT_QPA_PLATFORM").isEmpty())
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QGuiApplication app(argc, argv);
+    QCoreApplication::setApplicationName("fontConverterCli");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Converts BMFont .fnt files and images to C source files or binary blobs.\n"
+                                     "Every .fnt file and every image directory is a separate job;\n"
+                                     "image files given directly are collected into one image set.");
+    parser.addHelpOption();
+
+    QCommandLineOption presetOpt(QStringList() << "p" << "preset",
+                                 "Output preset: esp8266 (default), generic8 or generic32.", "preset", "esp8266");
+    QCommandLineOption bitsOpt(QStringList() << "b" << "bits",
+                               "Bit count: 8 or 32 (default: from preset).", "bits");
+    QCommandLineOption bitOrderOpt("bit-order", "Bit order: msb (default) or lsb.", "order", "msb");
+    QCommandLineOption depthOpt(QStringList() << "d" << "depth",
+                                "Bits per pixel: 1 (default), or 2 and 4 for gray levels on grayscale\n"
+                                "displays such as SSD1322 and SSD1327.", "bits", "1");
+    QCommandLineOption ditherOpt("dither", "Image dithering: none (default), fs (Floyd-Steinberg), atkinson\n"
+                                           "or bayer (ordered).", "method", "none");
+    QCommandLineOption formatOpt(QStringList() << "f" << "format",
+                                 "Output format: c (default) or bin.", "format", "c");
+    QCommandLineOption rleOpt("rle", "Run-length encode bitmaps that get smaller by it.");
+    QCommandLineOption sparseOpt("sparse", "Sparse font table of code,glyph pairs with a lookup function,\n"
+                                           "instead of one entry per char from first to last.");
+    QCommandLineOption kerningOpt("kerning", "Emit glyph metrics and kerning pairs with a lookup function.");
+    QCommandLineOption packedOpt("packed", "Write the font as one array with a 16 bit offset table,\n"
+                                           "instead of an array per glyph and a pointer table.");
+    QCommandLineOption thresholdOpt(QStringList() << "t" << "threshold",
+                                    "Width threshold 1-7 (default: 4).", "threshold", "4");
+    QCommandLineOption cutoffOpt("cutoff",
+                                 "Atlas channel value at which a font pixel is set, 1-255 (default: 128).", "value", "128");
+    QCommandLineOption firstOpt("first", "First font character (default: 32).", "char", "32");
+    QCommandLineOption lastOpt("last", "Last font character (default: 126).", "char", "126");
+    QCommandLineOption includesOpt("includes", "Includes (default: from preset).", "text");
+    QCommandLineOption syntax1Opt("array-syntax1", "Bitmap array declaration syntax (default: from preset).", "syntax");
+    QCommandLineOption syntax2Opt("array-syntax2", "Font table declaration syntax (default: from preset).", "syntax");
+    QCommandLineOption outputOpt(QStringList() << "o" << "output",
+                                 "Output directory (default: next to the input).", "dir");
+    QCommandLineOption imagesNameOpt("images-name",
+                                     "Name of the set of loose image files (default: images).", "name", "images");
+    QCommandLineOption cacheDirOpt("cache-dir", "Conversion cache directory (default: the user cache directory).\n"
+                                                "Jobs whose input files and settings did not change are not converted again.", "dir");
+    QCommandLineOption cacheSizeOpt("cache-size", "Size the cache is pruned to after a run, least recently used\n"
+                                                  "entries first (default: 64 MB).", "MB", "64");
+    QCommandLineOption noCacheOpt("no-cache", "Convert every job, without reading or filling the cache.");
+    QCommandLineOption watchOpt(QStringList() << "w" << "watch",
+                                "Convert, then keep watching the .fnt files, their atlas pages and the images,\n"
+                                "and write the output again when they change (no cache).");
+    QCommandLineOption jobsOpt(QStringList() << "j" << "jobs",
+                               "Number of parallel jobs (default: number of cores).", "jobs");
+    parser.addOption(presetOpt);
+    parser.addOption(bitsOpt);
+    parser.addOption(bitOrderOpt);
+    parser.addOption(depthOpt);
+    parser.addOption(ditherOpt);
+    parser.addOption(formatOpt);
+    parser.addOption(rleOpt);
+    parser.addOption(sparseOpt);
+    parser.addOption(kerningOpt);
+    parser.addOption(packedOpt);
+    parser.addOption(thresholdOpt);
+    parser.addOption(cutoffOpt);
+    parser.addOption(firstOpt);
+    parser.addOption(lastOpt);
+    parser.addOption(includesOpt);
+    parser.addOption(syntax1Opt);
+    parser.addOption(syntax2Opt);
+    parser.addOption(outputOpt);
+    parser.addOption(imagesNameOpt);
+    parser.addOption(cacheDirOpt);
+    parser.addOption(cacheSizeOpt);
+    parser.addOption(noCacheOpt);
+    parser.addOption(watchOpt);
+    parser.addOption(jobsOpt);
+    parser.addPositionalArgument("inputs", "Font files, image files or image directories.", "inputs...");
+    parser.process(app);
+
+    QStringList presetNames;
+    presetNames << "esp8266" << "generic8" << "generic32";
+    int presetId = presetNames.indexOf(parser.value(presetOpt).toLower());
+    if (presetId < 0)
+    {
+        printErr("Unknown preset " + parser.value(presetOpt));
+        return 1;
+    }
+    OutputPreset preset = OutputPreset::get(presetId);
+
+    Settings settings;
+    settings.includes = parser.isSet(includesOpt) ? parser.value(includesOpt) : preset.includes;
+    settings.arraySyntax1 = parser.isSet(syntax1Opt) ? parser.value(syntax1Opt) : preset.arraySyntax1;
+    settings.arraySyntax2 = parser.isSet(syntax2Opt) ? parser.value(syntax2Opt) : preset.arraySyntax2;
+    settings.bitcount32 = preset.bitcount32;
+    if (parser.isSet(bitsOpt))
+    {
+        QString bits = parser.value(bitsOpt);
+        if (bits != "8" && bits != "32")
+        {
+            printErr("Bit count must be 8 or 32");
+            return 1;
+        }
+        settings.bitcount32 = bits == "32";
+    }
+    QString bitOrder = parser.value(bitOrderOpt).toLower();
+    if (bitOrder != "msb" && bitOrder != "lsb")
+    {
+        printErr("Bit order must be msb or lsb");
+        return 1;
+    }
+    settings.format = bitOrder == "msb" ? QImage::Format_Mono : QImage::Format_MonoLSB;
+    settings.depth = parser.value(depthOpt).toInt();
+    if (settings.depth != 1 && settings.depth != 2 && settings.depth != 4)
+    {
+        printErr("Depth must be 1, 2 or 4");
+        return 1;
+    }
+    QStringList ditherNames;
+    ditherNames << "none" << "fs" << "atkinson" << "bayer";
+    int ditherId = ditherNames.indexOf(parser.value(ditherOpt).toLower());
+    if (ditherId < 0)
+    {
+        printErr("Dithering must be none, fs, atkinson or bayer");
+        return 1;
+    }
+    settings.dither = (Dither::Method)ditherId;
+    QString format = parser.value(formatOpt).toLower();
+    if (format != "c" && format != "bin")
+    {
+        printErr("Output format must be c or bin");
+        return 1;
+    }
+    settings.binary = format == "bin";
+    settings.rle = parser.isSet(rleOpt);
+    settings.sparse = parser.isSet(sparseOpt);
+    settings.kerning = parser.isSet(kerningOpt);
+    settings.packed = parser.isSet(packedOpt);
+    settings.threshold = parser.value(thresholdOpt).toInt();
+    settings.cutoff = parser.value(cutoffOpt).toInt();
+    settings.firstChar = parser.value(firstOpt).toInt();
+    settings.lastChar = parser.value(lastOpt).toInt();
+    if (settings.threshold < 1 || settings.threshold > 7 ||
+        settings.cutoff < 1 || settings.cutoff > 255 ||
+        settings.firstChar < 0 || settings.firstChar > settings.lastChar)
+    {
+        printErr("Invalid threshold, cutoff or character range");
+        return 1;
+    }
+    if (parser.isSet(outputOpt))
+    {
+        settings.outputDir = QDir(parser.value(outputOpt)).absolutePath();
+        QDir().mkpath(settings.outputDir);
+    }
+
+    if (!parser.isSet(noCacheOpt))
+    {
+        settings.cacheDir = parser.isSet(cacheDirOpt) ? QDir(parser.value(cacheDirOpt)).absolutePath()
+                                                      : QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+        bool ok;
+        int megabytes = parser.value(cacheSizeOpt).toInt(&ok);
+        if (!ok || megabytes < 0)
+        {
+            printErr("Invalid cache size");
+            return 1;
+        }
+        settings.cacheSize = (qint64)megabytes*1024*1024;
+    }
+
+    QStringList inputs = parser.positionalArguments();
+    if (inputs.isEmpty())
+    {
+        parser.showHelp(1);
+    }
+
+    QList<Job> jobs = collectJobs(inputs, parser.value(imagesNameOpt));
+    if (jobs.isEmpty())
+    {
+        printErr("Nothing to convert");
+        return 1;
+    }
+    if (!checkOutputFiles(jobs, settings))
+    {
+        return 1;
+    }
+
+    int maxJobs = parser.isSet(jobsOpt) ? parser.value(jobsOpt).toInt() : QThread::idealThreadCount();
+    if (maxJobs < 1)
+    {
+        maxJobs = 1;
+    }
+
+    // every job has its own Converter, so jobs can run on separate threads
+    QThreadPool::globalInstance()->setMaxThreadCount(maxJobs);
+    if (parser.isSet(watchOpt))
+    {
+        return watchJobs(app, jobs, settings);
+    }
+    QList<bool> results = QtConcurrent::blockingMapped<QList<bool> >(jobs, RunJob(settings));
+    int failed = results.count(false);
+    if (!settings.cacheDir.isEmpty())
+    {
+        ConversionCache(settings.cacheDir).prune(settings.cacheSize);
+    }
+
+    if (failed)
+    {
+        printErr(QString("%1 of %2 jobs failed").arg(failed).arg(jobs.size()));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#include "conversioncache.h"
+#include "bmfont.h"
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <algorithm>
+
+
+ConversionCache::ConversionCache(const QString &dir):
+    dir(dir)
+{
+}
+
+QByteArray ConversionCache::key(const QStringList &files, const QString &settings)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    foreach (const QString &filename, files)
+    {
+        QFile file(filename);
+        if (!file.open(QIODevice::ReadOnly))
+        {
+            return QByteArray();
+        }
+        // the name goes in too, so the same bytes under another name (an image set) differ
+        hash.addData(QFileInfo(filename).fileName().toUtf8());
+        hash.addData("\0", 1);
+        if (!hash.addData(&file))
+        {
+            return QByteArray();
+        }
+    }
+    hash.addData(settings.toUtf8());
+    return hash.result().toHex();
+}
+
+QStringList ConversionCache::fontFiles(const QString &fntFile)
+{
+    BMFont font;
+    if (!font.load(fntFile))
+    {
+        return QStringList();
+    }
+    QStringList files;
+    files.append(fntFile);
+    QString fontDir = QFileInfo(fntFile).absolutePath();
+    foreach (const QString &page, font.pages)
+    {
+        files.append(fontDir+"/"+page);
+    }
+    return files;
+}
+
+QString ConversionCache::entryFile(const QByteArray &key) const
+{
+    // two levels, so a big cache does not end up in one huge directory
+    return dir + "/" + QString::fromLatin1(key.left(2)) + "/" + QString::fromLatin1(key);
+}
+
+bool ConversionCache::load(const QByteArray &key, QByteArray *output) const
+{
+    if (key.isEmpty())
+    {
+        return false;
+    }
+    QFile file(entryFile(key));
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    *output = file.readAll();
+    if (file.error() != QFile::NoError)
+    {
+        return false;
+    }
+    file.close();
+    touch(entryFile(key));
+    return true;
+}
+
+// Marks an entry as used now, prune() removes the entries with the oldest times first.
+void ConversionCache::touch(const QString &filename) const
+{
+#if QT_VERSION >= QT_VERSION_CHECK(5, 10, 0)
+    QFile file(filename);
+    if (file.open(QIODevice::ReadWrite))
+    {
+        file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    }
+#else
+    Q_UNUSED(filename);
+#endif
+}
+
+bool ConversionCache::store(const QByteArray &key, const QByteArray &output) const
+{
+    if (key.isEmpty())
+    {
+        return false;
+    }
+    QString filename = entryFile(key);
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+    file.write(output);
+    return file.commit();
+}
+
+static bool lessRecentlyUsed(const QFileInfo &a, const QFileInfo &b)
+{
+    return a.lastModified() < b.lastModified();
+}
+
+void ConversionCache::prune(qint64 maxBytes) const
+{
+    QList<QFileInfo> entries;
+    qint64 total = 0;
+    QDirIterator it(dir, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+        it.next();
+        // skip the temporary files of a store() that is still running
+        if (it.fileName().size() != 40)
+        {
+            continue;
+        }
+        entries.append(it.fileInfo());
+        total += it.fileInfo().size();
+    }
+
+    std::sort(entries.begin(), entries.end(), lessRecentlyUsed);
+    for (int i = 0; i < entries.size() && total > maxBytes; i++)
+    {
+        if (QFile::remove(entries.at(i).absoluteFilePath()))
+        {
+            total -= entries.at(i).size();
+        }
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef CONVERSIONCACHE_H
+#define CONVERSIONCACHE_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+
+// On-disk cache of generated files, keyed by a hash of the input files and of every setting
+// that shapes the output. A hit costs reading and hashing the inputs: nothing is decoded,
+// rasterized or emitted. Entries are written atomically, so parallel jobs can share the cache.
+class ConversionCache
+{
+public:
+    explicit ConversionCache(const QString &dir);
+
+    // SHA-1 in hex of the bytes of the files, in order, and of the settings text.
+    // Empty if one of the files cannot be read.
+    static QByteArray key(const QStringList &files, const QString &settings);
+    // The .fnt file followed by the atlas pages it uses, empty if it cannot be read.
+    static QStringList fontFiles(const QString &fntFile);
+
+    bool load(const QByteArray &key, QByteArray *output) const;
+    bool store(const QByteArray &key, const QByteArray &output) const;
+    // Removes the least recently used entries until the cache takes at most maxBytes.
+    void prune(qint64 maxBytes) const;
+
+private:
+    QString entryFile(const QByteArray &key) const;
+    void touch(const QString &filename) const;
+
+    QString dir;
+};
+
+
+#endif // CONVERSIONCACHE_H
@@ -1,15 +1,36 @@
 #include "converter.h"
+#include "rasterizer.h"
+#include "sourcewriter.h"
+#include "bitmapblob.h"
+#include "rle.h"
+#include "bmfont.h"
 #include <QFile>
 #include <QFileInfo>
 #include <QDir>
-#include <QDomDocument>
-#include <QPainter>
+#include <QVector>
+#include <QHash>
+#include <QSet>
+#include <QDateTime>
+#include <QtConcurrent>
+#include <QtEndian>
 #include <QDebug>
+#include <algorithm>
 
 
 Converter::Converter()
 {
-
+    cutoff = 128;
+    threshold = 4;
+    rle = false;
+    sparse = false;
+    kerning = false;
+    packed = false;
+    depth = 1;
+    dither = Dither::Threshold;
+    firstChar = 0;
+    lastChar = 0;
+    atlasChannel = MonoPacker::Green;
+    atlasInkBelow = true;
 }
 
 Converter::~Converter()
@@ -18,216 +39,938 @@ Converter::~Converter()
     clearImages();
 }
 
-static QPixmap createPixmap(QPixmap &srcImage, int x, int y, int width, int height, int xadvance, int threshold, bool &scaled)
+// Reverses the order of the pixels of depth bits in a byte, the bits of a pixel keep their order.
+struct BitReverseTable{
+    BitReverseTable(int depth){
+        int mask = (1<<depth)-1;
+        for (int i = 0; i < 256; i++)
+        {
+            uchar reversed = 0;
+            for (int bit = 0; bit < 8; bit += depth)
+            {
+                reversed |= ((i >> bit) & mask) << (8-depth-bit);
+            }
+            table[i] = reversed;
+        }
+    }
+    uchar table[256];
+};
+
+// Returns the packed bitmap in the requested bit order.
+static QByteArray orderedBitmap(const QByteArray &bitmap, QImage::Format format, int depth)
+{
+    if (format != QImage::Format_MonoLSB)
+    {
+        return bitmap;
+    }
+
+    static const BitReverseTable reverse[] = { BitReverseTable(1), BitReverseTable(2), BitReverseTable(4) };
+    const uchar *table = reverse[depth/2].table;
+    QByteArray lsbFirst(bitmap.size(), 0);
+    const uchar *src = (const uchar*)bitmap.constData();
+    uchar *dst = (uchar*)lsbFirst.data();
+    for (int i = 0; i < bitmap.size(); i++)
+    {
+        dst[i] = table[src[i]];
+    }
+    return lsbFirst;
+}
+
+// Bitmap rows are whole bytes, so a custom width (which can be typed into the
+// spin box) is rounded up to a multiple of 8.
+static int alignedWidth(int width)
+{
+    return (width+7)/8*8;
+}
+
+// First header byte: the width (a multiple of 8), log2 of the depth in bit 1 and 2, bit 0 for RLE.
+static int headerWidth(int width, int depth, bool encoded)
+{
+    Q_ASSERT(width % 8 == 0);
+    return width | (depth/2) << 1 | (encoded ? 1 : 0);
+}
+
+static bool isBlankRow(const char *row, int bytes)
 {
-    QPixmap charPic = srcImage.copy(x, y, width, height);
+    for (int i = 0; i < bytes; i++)
+    {
+        if (row[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Drops the blank rows above and below the ink of a glyph, the rows above move into its yoffset.
+// Glyphs without ink, like the space, keep their width but no rows.
+static void trimRows(CharInfo *charInfo)
+{
+    int rowBytes = charInfo->width*charInfo->depth/8;
+    int height = charInfo->height;
+    const char *data = charInfo->bitmap.constData();
+    int top = 0;
+    while (top < height && isBlankRow(data + top*rowBytes, rowBytes))
+    {
+        top++;
+    }
+    int bottom = height;
+    while (bottom > top && isBlankRow(data + (bottom-1)*rowBytes, rowBytes))
+    {
+        bottom--;
+    }
+
+    if (top || bottom < height)
+    {
+        charInfo->bitmap = charInfo->bitmap.mid(top*rowBytes, (bottom-top)*rowBytes);
+    }
+    charInfo->height = bottom-top;
+    charInfo->yoffset = charInfo->attributes.yoffset + top;
+    charInfo->trimmedRows = height - charInfo->height;
+}
+
+// Packs the glyph straight from the atlas into charInfo->bitmap.
+static void packChar(CharInfo *charInfo, const QImage &atlas, int targetWidth, const MonoPacker &packer)
+{
+    QRect rect(charInfo->attributes.x, charInfo->attributes.y,
+               charInfo->attributes.width, charInfo->attributes.height);
+    charInfo->bitmap = Rasterizer::pack(atlas, rect, targetWidth, charInfo->scaled, packer);
+    charInfo->depth = packer.getDepth();
+    if (charInfo->bitmap.isEmpty())
+    {
+        targetWidth = 0;
+    }
+    charInfo->width = targetWidth;
+    charInfo->height = targetWidth ? rect.height() : 0;
+    trimRows(charInfo);
+}
+
+// Glyph rasterization task for the thread pool. Each task touches only its own CharInfo,
+// the pages of all glyphs are decoded beforehand.
+struct RasterizeChar{
+    typedef void result_type;
+
+    RasterizeChar(const QMap<int, QImage> &pages, int threshold, const MonoPacker &packer):
+        pages(pages), threshold(threshold), packer(packer)
+    {
+    }
 
-    int mod = xadvance%8;
-    if (mod)
+    void operator()(CharInfo *charInfo) const
     {
-        if (mod <= threshold && xadvance > 8)   // cut width
+        int targetWidth;
+        if (charInfo->useCustomWidth)
         {
-            xadvance -= mod;
-            if (xadvance < width)   // scale pic
+            targetWidth = alignedWidth(charInfo->customWidth);
+            charInfo->scaled = targetWidth < charInfo->attributes.width;
+        }
+        else
+        {
+            targetWidth = Rasterizer::targetWidth(charInfo->attributes.width,
+                                                  charInfo->attributes.xadvance,
+                                                  threshold,
+                                                  charInfo->scaled);
+        }
+        packChar(charInfo, pages.value(charInfo->attributes.page), targetWidth, packer);
+        charInfo->byteSize = charInfo->width*charInfo->depth*charInfo->height/8;
+        charInfo->rleSize = Rle::encode(charInfo->bitmap).size();
+    }
+
+    const QMap<int, QImage> &pages;
+    int threshold;
+    const MonoPacker &packer;
+};
+
+
+QImage Converter::bitmapToImage(const QByteArray &bitmap, int width, int height, int depth)
+{
+    if (depth > 1)
+    {
+        QImage image(width, height, QImage::Format_Indexed8);
+        if (image.isNull())
+        {
+            return image;
+        }
+        int levels = 1 << depth;
+        QVector<QRgb> colors;
+        for (int level = 0; level < levels; level++)
+        {
+            int gray = 255 - level*255/(levels-1);
+            colors.append(qRgb(gray, gray, gray));
+        }
+        image.setColorTable(colors);
+
+        const uchar *src = (const uchar*)bitmap.constData();
+        int rowBytes = width*depth/8;
+        for (int y = 0; y < height; y++, src += rowBytes)
+        {
+            uchar *line = image.scanLine(y);
+            for (int x = 0; x < width; x++)
             {
-                width = xadvance;
-                scaled = true;
-                return charPic.scaled(width, height, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+                int bit = x*depth;
+                line[x] = (src[bit/8] >> (8-depth-bit%8)) & (levels-1);
             }
         }
-        else    // increase width
+        return image;
+    }
+
+    QImage image(width, height, QImage::Format_Mono);
+    if (image.isNull())
+    {
+        return image;
+    }
+
+    QVector<QRgb> colors;
+    colors.append(qRgb(255, 255, 255));
+    colors.append(qRgb(0, 0, 0));
+    image.setColorTable(colors);
+
+    int byteWidth = width/8;
+    for (int y = 0; y < height; y++)
+    {
+        memcpy(image.scanLine(y), bitmap.constData()+y*byteWidth, byteWidth);
+    }
+    return image;
+}
+
+bool Converter::openFont(const QString &filename, int threshold, int firstChar, int lastChar)
+{
+    return loadFont(filename, threshold, firstChar, lastChar, QMap<int, CharInfo*>());
+}
+
+// kept: glyphs of the font opened before, whose include and custom width settings are taken
+// over by the glyphs with the same id.
+bool Converter::loadFont(const QString &filename, int threshold, int firstChar, int lastChar,
+                         const QMap<int, CharInfo*> &kept)
+{
+    BMFont font;
+    if (!font.load(filename) || font.pages.isEmpty())
+    {
+        return false;
+    }
+
+    fontInfo.name = font.face;
+    fontInfo.size = font.size;
+    fontInfo.stretch = font.stretchH;
+    setAtlasChannels(font.alphaChnl, font.redChnl, font.greenChnl, font.blueChnl);
+
+    clearChars();
+    pageFiles.clear();
+    fontFile = QFileInfo(filename).absoluteFilePath();
+    QString fontDir = QFileInfo(filename).absolutePath();
+    for (QMap<int, QString>::const_iterator it = font.pages.constBegin(); it != font.pages.constEnd(); ++it)
+    {
+        pageFiles.insert(it.key(), fontDir+"/"+it.value());
+    }
+
+    // glyphs are rasterized when they enter the char range, so their pages are only decoded then
+    foreach (const BMFontChar &ch, font.chars)
+    {
+        CharInfo *charInfo = new CharInfo;
+        charInfo->id = ch.id;
+        charInfo->attributes.x = ch.x;
+        charInfo->attributes.y = ch.y;
+        charInfo->attributes.width = ch.width;
+        charInfo->attributes.height = ch.height;
+        charInfo->attributes.xoffset = ch.xoffset;
+        charInfo->attributes.xadvance = ch.xadvance;
+        charInfo->attributes.yoffset = ch.yoffset;
+        charInfo->yoffset = ch.yoffset;
+        charInfo->attributes.page = ch.page;
+        charInfo->skip = false;
+        const CharInfo *old = kept.value(ch.id, NULL);
+        if (old)
         {
-            xadvance += (8-mod);
+            charInfo->skip = old->skip;
+            charInfo->useCustomWidth = old->useCustomWidth;
+            charInfo->customWidth = old->customWidth;
         }
+        delete fontChars.value(charInfo->id, NULL);
+        fontChars.insert(charInfo->id, charInfo);
     }
+    kernings = font.kernings;
+    this->threshold = threshold;
 
-    int xoffset = ((double)(xadvance-width))/2 + 0.5;
-    QImage newImg(xadvance, height, QImage::Format_RGB32);
-    newImg.fill(Qt::white);
+    return setCharRange(firstChar, lastChar);
+}
 
-    QRectF source(0.0, 0.0, width, height);
-    QRectF target(xoffset, 0.0, width, height);
-    QPainter painter;
-    painter.begin(&newImg);
-    painter.drawPixmap(target, charPic, source);
-    painter.end();
+// Returns the decoded atlas page, decoded pages are cached until their file changes.
+QImage Converter::pageImage(int page)
+{
+    QString filename = pageFiles.value(page);
+    QDateTime modified = QFileInfo(filename).lastModified();
+    QHash<QString, AtlasPage>::const_iterator cached = pageCache.constFind(filename);
+    if (cached != pageCache.constEnd() && cached->modified == modified)
+    {
+        return cached->image;
+    }
 
-    scaled = false;
-    return QPixmap::fromImage(newImg);
+    QImage image(filename);
+    if (image.isNull())
+    {
+        return image;
+    }
+    AtlasPage atlasPage;
+    atlasPage.modified = modified;
+    atlasPage.image = image.convertToFormat(QImage::Format_ARGB32);
+    pageCache.insert(filename, atlasPage);
+    return atlasPage.image;
 }
 
-static QPixmap createPixmap(QPixmap &srcImage, int x, int y, int width, int height, int targetWidth, bool &scaled)
+// Rasterizes the glyphs on all cores, every glyph is independent.
+// Returns false if a page that one of them is on cannot be read.
+bool Converter::rasterizeChars(const QVector<CharInfo*> &glyphs)
 {
-    QPixmap charPic = srcImage.copy(x, y, width, height);
+    bool ok = true;
+    QMap<int, QImage> pages;
+    foreach (CharInfo *ch, glyphs)
+    {
+        int page = ch->attributes.page;
+        if (!pages.contains(page))
+        {
+            pages.insert(page, pageImage(page));
+            ok &= !pages.value(page).isNull();
+        }
+    }
 
-    if (targetWidth < width)
+    MonoPacker packer(atlasChannel, cutoff, atlasInkBelow, false, depth);
+    QtConcurrent::blockingMap(glyphs, RasterizeChar(pages, threshold, packer));
+
+    foreach (CharInfo *ch, glyphs)
     {
-        qDebug() << "getCharPic width" << width << "targetWidth" << targetWidth;
-        scaled = true;
-        return charPic.scaled(targetWidth, height, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+        if (!ch->useCustomWidth)
+        {
+            ch->customWidth = ch->width;
+        }
+        ch->rasterized = true;
     }
+    return ok;
+}
 
-    int xoffset = ((double)(targetWidth-width))/2 + 0.5;
-    QImage newImg(targetWidth, height, QImage::Format_RGB32);
-    newImg.fill(Qt::white);
+QList<int> Converter::setThreshold(int threshold)
+{
+    this->threshold = threshold;
+
+    // only glyphs with xadvance%8 != 0 can change, and only if the new target width differs
+    QVector<CharInfo*> changed;
+    foreach (CharInfo *ch, fontChars)
+    {
+        if (!ch->rasterized || ch->useCustomWidth)
+        {
+            continue;
+        }
+        bool scaled;
+        int targetWidth = Rasterizer::targetWidth(ch->attributes.width, ch->attributes.xadvance,
+                                                  threshold, scaled);
+        if ((targetWidth != ch->width && ch->width) || scaled != ch->scaled)
+        {
+            changed.append(ch);
+        }
+    }
 
-    QRectF source(0.0, 0.0, width, height);
-    QRectF target(xoffset, 0.0, width, height);
-    QPainter painter;
-    painter.begin(&newImg);
-    painter.drawPixmap(target, charPic, source);
-    painter.end();
+    rasterizeChars(changed);
 
-    scaled = false;
-    return QPixmap::fromImage(newImg);
+    QList<int> indexes;
+    foreach (CharInfo *ch, changed)
+    {
+        int index = charIndex(ch->id);
+        if (index >= 0)
+        {
+            indexes.append(index);
+        }
+    }
+    std::sort(indexes.begin(), indexes.end());
+    updateFontInfo();
+    return indexes;
 }
 
-bool Converter::openFont(const QString &filename, int threshold, int firstChar, int lastChar)
+bool Converter::setCharRange(int firstChar, int lastChar)
 {
-    QFile file(filename);
-    QDomDocument doc;
-    if (!file.open(QIODevice::ReadOnly) || !doc.setContent(&file))
+    this->firstChar = firstChar;
+    this->lastChar = lastChar;
+    chars.clear();
+    QVector<CharInfo*> pending;
+    if (sparse)
+    {
+        // only the glyphs the font has, no placeholders for the ids in between
+        QMap<int, CharInfo*>::const_iterator it = fontChars.lowerBound(firstChar);
+        for (; it != fontChars.constEnd() && it.key() <= lastChar; ++it)
+        {
+            if (!it.value()->rasterized)
+            {
+                pending.append(it.value());
+            }
+            chars.append(it.value());
+        }
+    }
+    for (int id = firstChar; id <= lastChar && !sparse; id++)
+    {
+        CharInfo *ch = fontChars.value(id, NULL);
+        if (ch && !ch->rasterized)
+        {
+            pending.append(ch);
+        }
+        if (!ch)
+        {
+            ch = missingChars.value(id, NULL);
+        }
+        if (!ch)
+        {
+            ch = new CharInfo;
+            ch->id = id;
+            ch->skip = true;
+            ch->byteSize = 0;
+            missingChars.insert(id, ch);
+        }
+        chars.append(ch);
+    }
+
+    bool ok = rasterizeChars(pending);
+    updateFontInfo();
+    return ok;
+}
+
+int Converter::charIndex(int id) const
+{
+    // chars are sorted by id
+    int lo = 0;
+    int hi = chars.size();
+    while (lo < hi)
+    {
+        int mid = (lo+hi)/2;
+        if (chars.at(mid)->id < id)
+        {
+            lo = mid+1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    return (lo < chars.size() && chars.at(lo)->id == id) ? lo : -1;
+}
+
+static int trimmedBytes(const CharInfo *charInfo)
+{
+    return charInfo->trimmedRows*charInfo->width*charInfo->depth/8;
+}
+
+void Converter::updateFontInfo()
+{
+    fontInfo.overallSize = 0;
+    fontInfo.trimmedBytes = 0;
+    fontInfo.used = 0;
+    foreach (CharInfo *ch, chars)
+    {
+        if (!ch->skip)
+        {
+            fontInfo.used++;
+            fontInfo.overallSize += ch->byteSize;
+            fontInfo.trimmedBytes += trimmedBytes(ch);
+        }
+    }
+    fontInfo.first = chars.isEmpty() ? 0 : chars.first()->id;
+    fontInfo.last = chars.isEmpty() ? 0 : chars.last()->id;
+    fontInfo.count = chars.size();
+}
+
+bool Converter::openImage(const QString &filename, int threshold)
+{
+    QImage origImg = QImage(filename);
+    if (origImg.isNull())
     {
-        file.close();
         return false;
     }
-    file.close();
+    ImageInfo *img = new ImageInfo;
+    int targetWidth = Rasterizer::targetWidth(origImg.width(), origImg.width(), threshold, img->scaled);
+    QImage image = Rasterizer::paint(origImg, origImg.rect(), targetWidth, img->scaled);
+    img->bitmap = Rasterizer::packImage(image, depth, dither);
+    img->width = image.width();
+    img->height = image.height();
+    img->depth = depth;
+    img->byteSize = img->width*depth*img->height/8;
+    img->rleSize = Rle::encode(img->bitmap).size();
+    img->customWidth = img->width;
+    img->source = origImg;
+    img->srcFile = filename;
+    img->name = QFileInfo(filename).baseName();
+    images.append(img);
+    imgFiles.append(filename);
+    return true;
+}
 
-    QDomElement root = doc.documentElement();
-    if( root.tagName() == "font" )
+QStringList Converter::getFontFiles() const
+{
+    QStringList files;
+    if (fontFile.isEmpty() || fontChars.isEmpty())
+    {
+        return files;
+    }
+    files.append(fontFile);
+    foreach (const QString &page, pageFiles)
     {
-        QDomElement element = root.firstChildElement("info");
-        if (!element.isNull())
+        if (!files.contains(page))
         {
-            fontInfo.name = element.attribute("face");
-            fontInfo.size = element.attribute("size").toInt();
-            fontInfo.stretch = element.attribute("stretchH").toInt();
+            files.append(page);
         }
+    }
+    return files;
+}
+
+QList<int> Converter::reloadFontFiles(const QStringList &files, bool *ok)
+{
+    // a quick save may not move the timestamp the page cache goes by
+    foreach (const QString &file, files)
+    {
+        pageCache.remove(file);
+    }
+
+    QList<int> indexes;
+    if (files.contains(fontFile))
+    {
+        // the old glyphs are taken out of the font, so they outlive the reopen for their settings
+        QMap<int, CharInfo*> kept = fontChars;
+        fontChars.clear();
+        *ok = loadFont(fontFile, threshold, firstChar, lastChar, kept);
+        if (fontChars.isEmpty())
+        {
+            // the .fnt could not be read, keep the font as it was
+            fontChars = kept;
+            return indexes;
+        }
+        qDeleteAll(kept);
+        for (int i = 0; i < chars.size(); i++)
+        {
+            indexes.append(i);
+        }
+        return indexes;
+    }
 
-        element = root.firstChildElement("pages").firstChildElement("page");
-        if (!element.isNull())
+    QVector<CharInfo*> changed;
+    QVector<CharInfo*> custom;
+    foreach (CharInfo *ch, fontChars)
+    {
+        // glyphs outside the range are rasterized from the new page when they enter it
+        if (ch->rasterized && files.contains(pageFiles.value(ch->attributes.page)))
         {
-            QString imageFilename = QFileInfo(file).absolutePath()+"/"+element.attribute("file");
-            qDebug() << imageFilename;
-            fontImage = QPixmap(imageFilename);
-            if (fontImage.isNull())
+            if (ch->useCustomWidth)
             {
-                return false;
+                custom.append(ch);
+            }
+            else
+            {
+                changed.append(ch);
             }
         }
-        else
+    }
+    *ok = rasterizeChars(changed);
+    if (*ok)
+    {
+        foreach (CharInfo *ch, custom)
         {
-            return false;
+            recreateCharPic(ch, threshold);
+            changed.append(ch);
+        }
+    }
+
+    foreach (CharInfo *ch, changed)
+    {
+        int index = charIndex(ch->id);
+        if (index >= 0)
+        {
+            indexes.append(index);
         }
     }
+    std::sort(indexes.begin(), indexes.end());
+    updateFontInfo();
+    return indexes;
+}
+
+QList<int> Converter::reloadImages(const QStringList &files, int threshold, bool *ok)
+{
+    *ok = true;
+    QList<int> indexes;
+    for (int i = 0; i < images.size(); i++)
+    {
+        ImageInfo *img = images.at(i);
+        if (!files.contains(img->srcFile))
+        {
+            continue;
+        }
+        QImage source(img->srcFile);
+        if (source.isNull())
+        {
+            *ok = false;
+            continue;
+        }
+        img->source = source;
+        recreateImgPic(img, threshold);
+        indexes.append(i);
+    }
+    return indexes;
+}
+
+
+void Converter::clearChars()
+{
+    foreach (CharInfo *ch, fontChars)
+    {
+        delete ch;
+    }
+    foreach (CharInfo *ch, missingChars)
+    {
+        delete ch;
+    }
+    fontChars.clear();
+    missingChars.clear();
+    chars.clear();
+}
+
+void Converter::clearImages()
+{
+    foreach (ImageInfo *img, images)
+    {
+        delete img;
+    }
+    images.clear();
+    imgFiles.clear();
+}
+
+
+int Converter::getMinYoffset() const
+{
+    int minYoffset = INT_MAX;
+    foreach (CharInfo *ch, chars)
+    {
+        if (!ch->skip && ch->yoffset < minYoffset)
+        {
+            minYoffset = ch->yoffset;
+        }
+    }
+    return minYoffset;
+}
+
+// For every char the index of the char whose bitmap array it points to, -1 for skipped chars.
+// Chars with the same header and bitmap all use the array of the first of them.
+QVector<int> Converter::sharedChars(int minYoffset) const
+{
+    QVector<int> owners(chars.size(), -1);
+    QHash<QByteArray, int> unique;
+    for (int i = 0; i < chars.size(); i++)
+    {
+        const CharInfo *ch = chars.at(i);
+        if (ch->skip)
+        {
+            continue;
+        }
+
+        int header[3] = { ch->width, ch->height, ch->yoffset-minYoffset };
+        QByteArray key((const char*)header, sizeof(header));
+        key.append(ch->bitmap);
+        owners[i] = unique.value(key, i);
+        if (owners[i] == i)
+        {
+            unique.insert(key, i);
+        }
+    }
+    return owners;
+}
+
+int Converter::getSharedBytes() const
+{
+    QVector<int> owners = sharedChars(getMinYoffset());
+    int shared = 0;
+    for (int i = 0; i < chars.size(); i++)
+    {
+        if (owners.at(i) >= 0 && owners.at(i) != i)
+        {
+            shared += chars.at(i)->byteSize;
+        }
+    }
+    return shared;
+}
+
+// Initial capacity estimate for the source text, so the writer rarely needs to grow.
+static int estimateSourceSize(int dataBytes, int items, const QString &includes)
+{
+    return dataBytes*6 + items*160 + includes.size()*2 + 1024;
+}
+
+static void writeWords(SourceWriter &out, const uchar *data, int byteSize, int dwordSize)
+{
+    QVector<uint> words(dwordSize);
+    memcpy(words.data(), data, byteSize);
+    out.hexWords(words.constData(), dwordSize);
+}
+
+// One line per bitmap row, run-length encoded bitmaps are split into lines of rleLineBytes.
+static const int rleLineBytes = 16;
+
+static void writeLines(SourceWriter &out, const uchar *data, int byteSize, int lineBytes)
+{
+    const char *lastChar = "";
+    for (int pos = 0; pos < byteSize; pos += lineBytes)
+    {
+        out << lastChar << "\n";
+        out.hexBytes(data + pos, qMin(lineBytes, byteSize-pos));
+        lastChar = ",";
+    }
+}
+
+// The bitmap as it goes into the output: in the requested bit order, and run-length
+// encoded if that is enabled and makes it smaller.
+static QByteArray outputBitmap(const QByteArray &bitmap, QImage::Format format, int depth, bool rle,
+                               bool *encoded)
+{
+    QByteArray data = orderedBitmap(bitmap, format, depth);
+    *encoded = false;
+    if (rle)
+    {
+        QByteArray packed = Rle::encode(data);
+        if (packed.size() < data.size())
+        {
+            *encoded = true;
+            return packed;
+        }
+    }
+    return data;
+}
+
+// Sparse font table: the number of glyphs, then code,glyph pairs sorted by code,
+// followed by a binary search function <fontname>_glyph() for the MCU.
+void Converter::writeSparseTable(SourceWriter &out, const QString &fontname, bool bitcount32,
+                                 const QString &arraySyntax2, const QVector<int> &owners)
+{
+    const char *type = bitcount32 ? "unsigned int" : "unsigned char";
+    out << QString(arraySyntax2).arg(fontname).arg(fontInfo.used*2+1) << "\n";
+    out << "(" << type << "*)" << fontInfo.used;
+    for (int i = 0; i < chars.size(); i++)
+    {
+        if (owners.at(i) >= 0)
+        {
+            out << ",\n(" << type << "*)" << chars.at(i)->id << ",char" << chars.at(owners.at(i))->id;
+        }
+    }
+    out << "};\n\n";
+
+    out << "const " << type << " *" << fontname << "_glyph(unsigned long code)\n"
+        << "{\n"
+        << "    unsigned long lo = 0, hi = (unsigned long)" << fontname << "[0];\n"
+        << "    while (lo < hi)\n"
+        << "    {\n"
+        << "        unsigned long mid = (lo+hi)/2;\n"
+        << "        if ((unsigned long)" << fontname << "[1+2*mid] < code)\n"
+        << "            lo = mid+1;\n"
+        << "        else\n"
+        << "            hi = mid;\n"
+        << "    }\n"
+        << "    if (lo < (unsigned long)" << fontname << "[0] && (unsigned long)" << fontname << "[1+2*lo] == code)\n"
+        << "        return " << fontname << "[2+2*lo];\n"
+        << "    return 0;\n"
+        << "}\n";
+}
+
+// A byte table as one array of the output word size, read on the MCU through <fontname>_byte().
+static void writeByteTable(SourceWriter &out, const QString &name, const QByteArray &table,
+                           bool bitcount32, const QString &arraySyntax1)
+{
+    const uchar *data = (const uchar*)table.constData();
+    int byteSize = table.size();
+    if (bitcount32)
+    {
+        int dwordSize = (byteSize+3)/4;
+        out << QString(arraySyntax1).arg(name).arg(dwordSize) << "\n";
+        writeWords(out, data, byteSize, dwordSize);
+    }
+    else
+    {
+        out << QString(arraySyntax1).arg(name).arg(byteSize);
+        writeLines(out, data, byteSize, rleLineBytes);
+    }
+    out << "};\n";
+}
+
+// Byte reads that only use aligned word loads in the 32 bit output, as ICACHE_RODATA needs.
+static void writeByteReader(SourceWriter &out, const QString &fontname, bool bitcount32)
+{
+    const char *type = bitcount32 ? "unsigned int" : "unsigned char";
+    out << "static unsigned long " << fontname << "_byte(const " << type << " *table, unsigned long i)\n"
+        << "{\n";
+    if (bitcount32)
+    {
+        out << "    return (table[i >> 2] >> ((i & 3)*8)) & 0xFF;\n";
+    }
     else
+    {
+        out << "    return table[i];\n";
+    }
+    out << "}\n\n";
+}
+
+// Metrics and kerning pairs as byte tables, with accessors and a binary search
+// kerning lookup <fontname>_kern() for the MCU.
+void Converter::writeKerning(SourceWriter &out, const QString &fontname, bool bitcount32,
+                             const QString &arraySyntax1)
+{
+    out << "\n";
+    writeByteTable(out, fontname+"_metrics", getMetricsData(), bitcount32, arraySyntax1);
+    out << "\n";
+    writeByteTable(out, fontname+"_kernpairs", getKerningData(), bitcount32, arraySyntax1);
+
+    const char *type = bitcount32 ? "unsigned int" : "unsigned char";
+    out << "\n"
+        << "/* slot: index of the glyph in the font table, without the header entries */\n"
+        << "int " << fontname << "_xoffset(unsigned long slot)\n"
+        << "{\n"
+        << "    return (signed char)" << fontname << "_byte(" << fontname << "_metrics, 2*slot);\n"
+        << "}\n\n"
+        << "int " << fontname << "_xadvance(unsigned long slot)\n"
+        << "{\n"
+        << "    return " << fontname << "_byte(" << fontname << "_metrics, 2*slot+1);\n"
+        << "}\n\n"
+        << "int " << fontname << "_kern(unsigned long first, unsigned long second)\n"
+        << "{\n"
+        << "    const " << type << " *t = " << fontname << "_kernpairs;\n"
+        << "    unsigned long key = (first << 16) | second;\n"
+        << "    unsigned long lo = 0, hi = " << fontname << "_byte(t, 0) | " << fontname << "_byte(t, 1) << 8;\n"
+        << "    while (lo < hi)\n"
+        << "    {\n"
+        << "        unsigned long mid = (lo+hi)/2, at = 2+5*mid;\n"
+        << "        unsigned long k = (" << fontname << "_byte(t, at) | " << fontname << "_byte(t, at+1) << 8) << 16 |\n"
+        << "                          " << fontname << "_byte(t, at+2) | " << fontname << "_byte(t, at+3) << 8;\n"
+        << "        if (k < key)\n"
+        << "            lo = mid+1;\n"
+        << "        else if (k > key)\n"
+        << "            hi = mid;\n"
+        << "        else\n"
+        << "            return (signed char)" << fontname << "_byte(t, at+4);\n"
+        << "    }\n"
+        << "    return 0;\n"
+        << "}\n";
+}
+
+// Packed font: one blob that holds everything, so it needs no pointers and no relocations.
+// u32 first code, u16 glyph count, u16 flags (bit 0: sparse), then the glyph table, then the
+// glyph records aligned to the word size. A record is u8 width (as in the per glyph header),
+// u8 height, u8 reserved (0), u8 yoffset and the bitmap; for 32 bit output the four header
+// bytes share one word. The bitmap size is not stored, it would not fit a byte for large
+// glyphs: it is height*width*depth/8 bytes, or the length of the RLE stream that decodes to that.
+// Table entries are u16 record offsets from the start of the blob in words (bytes for 8 bit
+// output), 0 for no glyph; sparse fonts have a u16 code-first before each offset.
+// Returns false if the offsets or codes do not fit into 16 bits.
+bool Converter::packFont(bool bitcount32, QImage::Format format, int minYoffset,
+                         const QVector<int> &owners, QByteArray *blob) const
+{
+    int align = bitcount32 ? 4 : 1;
+
+    QVector<int> slots;
+    for (int i = 0; i < chars.size(); i++)
+    {
+        if (!sparse || owners.at(i) >= 0)
+        {
+            slots.append(i);
+        }
+    }
+    int first = slots.isEmpty() ? 0 : chars.at(slots.first())->id;
+    if (slots.size() > 0xFFFF)
     {
         return false;
     }
 
-    QMap<int, CharInfo*> charsTemp;
-    QDomNodeList chs = doc.elementsByTagName("char");
-    for (int i=0; i < chs.count(); i++)
+    int entrySize = sparse ? 4 : 2;
+    QByteArray data(8 + slots.size()*entrySize, 0);
+    uchar *header = (uchar*)data.data();
+    qToLittleEndian<quint32>(first, header);
+    qToLittleEndian<quint16>(slots.size(), header+4);
+    qToLittleEndian<quint16>(sparse ? 1 : 0, header+6);
+
+    QVector<int> offsets(chars.size(), 0);
+    for (int i = 0; i < chars.size(); i++)
     {
-        QDomElement ch = chs.item(i).toElement();
+        if (owners.at(i) != i)
+        {
+            continue;
+        }
+        data.append(QByteArray((align - data.size()%align)%align, 0));
+        offsets[i] = data.size()/align;
+        if (offsets[i] > 0xFFFF)
+        {
+            return false;
+        }
 
-        CharInfo *charInfo = new CharInfo;
-        charInfo->id = ch.attribute("id").toInt();
-        charInfo->attributes.x = ch.attribute("x").toInt();
-        charInfo->attributes.y = ch.attribute("y").toInt();
-        charInfo->attributes.width = ch.attribute("width").toInt();
-        charInfo->attributes.height = ch.attribute("height").toInt();
-        charInfo->attributes.xadvance = ch.attribute("xadvance").toInt();
-        charInfo->attributes.yoffset = ch.attribute("yoffset").toInt();
-        charInfo->charPic = createPixmap(fontImage,
-                                       charInfo->attributes.x,
-                                       charInfo->attributes.y,
-                                       charInfo->attributes.width,
-                                       charInfo->attributes.height,
-                                       charInfo->attributes.xadvance,
-                                       threshold,
-                                       charInfo->scaled);
-        charInfo->width = charInfo->charPic.width();
-        charInfo->height = charInfo->charPic.height();
-        charInfo->byteSize = charInfo->width*charInfo->height/8;
-        charInfo->skip = false;
-        charInfo->customWidth = charInfo->width;
-        charsTemp.insert(charInfo->id, charInfo);
+        const CharInfo *ch = chars.at(i);
+        bool encoded;
+        QByteArray bitmap = outputBitmap(ch->bitmap, format, ch->depth, rle, &encoded);
+        data.append((char)headerWidth(ch->width, ch->depth, encoded));
+        data.append((char)ch->height);
+        data.append((char)0);
+        data.append((char)(ch->yoffset-minYoffset));
+        data.append(bitmap);
     }
+    data.append(QByteArray((align - data.size()%align)%align, 0));
 
-    clearChars();
-    fontInfo.overallSize = 0;
-    fontInfo.used = 0;
-    for (int id = firstChar; id <= lastChar; id++)
+    uchar *table = (uchar*)data.data() + 8;
+    for (int k = 0; k < slots.size(); k++, table += entrySize)
     {
-        CharInfo *ch = charsTemp.value(id, NULL);
-        if (ch)
+        int i = slots.at(k);
+        int offset = owners.at(i) >= 0 ? offsets.at(owners.at(i)) : 0;
+        if (sparse)
         {
-            fontInfo.used++;
+            if (chars.at(i)->id - first > 0xFFFF)
+            {
+                return false;
+            }
+            qToLittleEndian<quint16>(chars.at(i)->id - first, table);
+            qToLittleEndian<quint16>(offset, table+2);
         }
         else
         {
-            ch = new CharInfo;
-            ch->id = id;
-            ch->skip = true;
-            ch->byteSize = 0;
+            qToLittleEndian<quint16>(offset, table);
         }
-        chars.append(ch);
-        fontInfo.overallSize += ch->byteSize;
     }
-    fontInfo.first = chars.first()->id;
-    fontInfo.last = chars.last()->id;
-    fontInfo.count = chars.size();
-    return true;
-}
 
-bool Converter::openImage(const QString &filename, int threshold)
-{
-    QPixmap origImg = QPixmap(filename);
-    if (origImg.isNull())
-    {
-        return false;
-    }
-    ImageInfo *img = new ImageInfo;
-    img->pixmap = createPixmap(origImg,
-                             0, 0,
-                             origImg.width(),
-                             origImg.height(),
-                             origImg.width(),
-                             threshold,
-                             img->scaled);
-    img->width = img->pixmap.width();
-    img->height = img->pixmap.height();
-    img->byteSize = img->width*img->height/8;
-    img->customWidth = img->width;
-    img->srcFile = filename;
-    img->name = QFileInfo(filename).baseName();
-    images.append(img);
-    imgFiles.append(filename);
+    *blob = data;
     return true;
 }
 
-
-void Converter::clearChars()
+// The packed blob and <fontname>_glyph(), which returns the record of a code point or 0.
+void Converter::writePackedFont(SourceWriter &out, const QString &fontname, bool bitcount32,
+                                const QString &arraySyntax1, const QByteArray &blob)
 {
-    foreach (CharInfo *ch, chars)
+    const char *type = bitcount32 ? "unsigned int" : "unsigned char";
+    out << "/* first (u32), count (u16), flags (u16), " << (sparse ? "code-first,offset" : "offset")
+        << " per glyph (u16, in " << (bitcount32 ? "words" : "bytes") << "), glyph records (width, height, 0, yoffset, bitmap) */\n";
+    writeByteTable(out, fontname, blob, bitcount32, arraySyntax1);
+
+    QString b = fontname+"_byte("+fontname+", ";
+    out << "\n"
+        << "const " << type << " *" << fontname << "_glyph(unsigned long code)\n"
+        << "{\n"
+        << "    unsigned long first = " << b << "0) | " << b << "1) << 8 | " << b << "2) << 16 | " << b << "3) << 24;\n"
+        << "    unsigned long count = " << b << "4) | " << b << "5) << 8;\n"
+        << "    unsigned long offset = 0;\n";
+    if (sparse)
     {
-        delete ch;
+        out << "    unsigned long lo = 0, hi = count;\n"
+            << "    while (lo < hi)\n"
+            << "    {\n"
+            << "        unsigned long mid = (lo+hi)/2;\n"
+            << "        if (first + (" << b << "8+4*mid) | " << b << "9+4*mid) << 8) < code)\n"
+            << "            lo = mid+1;\n"
+            << "        else\n"
+            << "            hi = mid;\n"
+            << "    }\n"
+            << "    if (lo < count && first + (" << b << "8+4*lo) | " << b << "9+4*lo) << 8) == code)\n"
+            << "        offset = " << b << "10+4*lo) | " << b << "11+4*lo) << 8;\n";
     }
-    chars.clear();
-}
-
-void Converter::clearImages()
-{
-    foreach (ImageInfo *img, images)
+    else
     {
-        delete img;
+        out << "    if (code >= first && code-first < count)\n"
+            << "        offset = " << b << "8+2*(code-first)) | " << b << "9+2*(code-first)) << 8;\n";
     }
-    images.clear();
-    imgFiles.clear();
+    out << "    return offset ? " << fontname << "+offset : 0;\n"
+        << "}\n";
 }
 
-
 bool Converter::generateFont(const QString &filename,
                              const QString &fontname,
                              const QString &includes,
@@ -237,117 +980,125 @@ bool Converter::generateFont(const QString &filename,
                              const QString &arraySyntax2
                              )
 {
-    QFile file(filename);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    int minYoffset = getMinYoffset();
+    QVector<int> owners = sharedChars(minYoffset);
+    QByteArray packedData;
+    if (packed && !packFont(bitcount32, format, minYoffset, owners, &packedData))
     {
         return false;
     }
-    QTextStream out(&file);
 
-    int minYoffset = INT_MAX;
+    int dataBytes = 0;
     foreach (CharInfo *ch, chars)
     {
-        if (!ch->skip && ch->attributes.yoffset < minYoffset)
-        {
-            minYoffset = ch->attributes.yoffset;
-        }
+        dataBytes += ch->byteSize;
     }
 
+    SourceWriter out(estimateSourceSize(dataBytes, chars.size(), includes));
     out << includes << "\n";
 
-    QString lastChar = "";
-    foreach (CharInfo *ch, chars)
+    if (packed || kerning)
     {
-        if (!ch->skip)
+        writeByteReader(out, fontname, bitcount32);
+    }
+
+    if (packed)
+    {
+        writePackedFont(out, fontname, bitcount32, arraySyntax1, packedData);
+    }
+    else
+    {
+        const char *lastChar = "";
+        for (int i = 0; i < chars.size(); i++)
         {
-            out << lastChar;
+            CharInfo *ch = chars.at(i);
+            if (owners.at(i) == i)
+            {
+                out << lastChar;
 
-            // bitmap data
-            QImage img = ch->charPic.toImage();
-            img = img.convertToFormat(format, Qt::MonoOnly);
+                // bitmap data
+                bool encoded;
+                QByteArray bitmap = outputBitmap(ch->bitmap, format, ch->depth, rle, &encoded);
+                const uchar *data = (const uchar*)bitmap.constData();
+                int byteSize = bitmap.size();
+                int header = headerWidth(ch->width, ch->depth, encoded);
 
-            int byteWidth = (ch->width/8);
-            QString lastChar2 = "";
-            if (bitcount32)
-            {
-                int dwordSize = ch->byteSize/4;
-                if (ch->byteSize%4)
+                int byteWidth = encoded ? rleLineBytes : (ch->width*ch->depth/8);
+                if (ch->id < 256)
                 {
-                    dwordSize++;
+                    out << "/* '" << QString(QChar::fromLatin1((char)ch->id)) << "' */\n";
                 }
-                uint *temp = new uint[dwordSize]();
-                uchar *pTemp = (uchar*)temp;
-                for (int y = 0, i = 0; y < ch->height; y++, i+=byteWidth)
+                else
                 {
-                    uchar *line = img.scanLine(y);
-                    memcpy(pTemp+i, line, byteWidth);
+                    out << "/* U+" << QString("%1").arg(ch->id, 4, 16, QChar('0')).toUpper() << " */\n";
                 }
+                if (bitcount32)
+                {
+                    int dwordSize = byteSize/4;
+                    if (byteSize%4)
+                    {
+                        dwordSize++;
+                    }
 
-                out << "/* '" << (char)ch->id << "' */\n";
-                out << QString(arraySyntax1).arg(QString("char%1").arg(ch->id)).arg(dwordSize+4) << "\n";
-                // header bytes
-                out << QString("%1,%2,%3,%4,").arg(ch->width).arg(ch->height).arg(dwordSize*4).arg(ch->attributes.yoffset-minYoffset) << "\n";
-
-                for (int i = 0; i < (dwordSize-1); i++)
+                    out << QString(arraySyntax1).arg(QString("char%1").arg(ch->id)).arg(dwordSize+4) << "\n";
+                    // header bytes
+                    out << header << "," << ch->height << "," << dwordSize*4 << "," << ch->yoffset-minYoffset << ",\n";
+                    writeWords(out, data, byteSize, dwordSize);
+                }
+                else    // 8bit
                 {
-                    out << QString().sprintf("0x%08X,", temp[i]);
+                    out << QString(arraySyntax1).arg(QString("char%1").arg(ch->id)).arg(byteSize+4) << "\n";
+                    // header bytes
+                    out << header << "," << ch->height << "," << byteSize << "," << ch->yoffset-minYoffset << ",";
+                    writeLines(out, data, byteSize, byteWidth);
                 }
-                out << QString().sprintf("0x%08X", temp[dwordSize-1]);
-                delete [] temp;
+
+                out << "};";
+                lastChar = "\n\n";
+            }
+        }
+        out << "\n\n\n";
+
+        if (sparse)
+        {
+            writeSparseTable(out, fontname, bitcount32, arraySyntax2, owners);
+        }
+        else
+        {
+            out << QString(arraySyntax2).arg(fontname).arg(fontInfo.count+2) << "\n";
+            if (bitcount32)
+            {
+                out << "(unsigned int*)" << fontInfo.first << ",(unsigned int*)" << fontInfo.last << ",\n";
             }
-            else    // 8bit
+            else
             {
-                out << "/* '" << (char)ch->id << "' */\n";
-                out << QString(arraySyntax1).arg(QString("char%1").arg(ch->id)).arg(ch->byteSize+4) << "\n";
-                // header bytes
-                out << QString("%1,%2,%3,%4,").arg(ch->width).arg(ch->height).arg(ch->byteSize).arg(ch->attributes.yoffset-minYoffset);
+                out << "(unsigned char*)" << fontInfo.first << ",(unsigned char*)" << fontInfo.last << ",\n";
+            }
 
-                for (int y = 0; y < ch->height; y++)
+            lastChar = "";
+            for (int i = 0; i < chars.size(); i++)
+            {
+                out << lastChar;
+                if (owners.at(i) < 0)
                 {
-                    out << lastChar2 << "\n";
-                    uchar *line = img.scanLine(y);
-                    for (int x = 0; x < (byteWidth-1); x++)
-                    {
-                        out << QString().sprintf("0x%02X,", line[x]);
-                    }
-                    out << QString().sprintf("0x%02X", line[byteWidth-1]);
-                    lastChar2 = ",";
+                    out << "0";
+                }
+                else
+                {
+                    out << "char" << chars.at(owners.at(i))->id;
                 }
+                lastChar = ",\n";
             }
-
-            out << "};";
-            lastChar = "\n\n";
+            out << "};\n";
         }
     }
-    out << "\n\n\n";
 
-    out << QString(arraySyntax2).arg(fontname).arg(fontInfo.count+2) << "\n";
-    if (bitcount32)
-    {
-        out << QString("(unsigned int*)%1,(unsigned int*)%2,\n").arg((int)fontInfo.first).arg((int)fontInfo.last);
-    }
-    else
+    if (kerning)
     {
-        out << QString("(unsigned char*)%1,(unsigned char*)%2,\n").arg((int)fontInfo.first).arg((int)fontInfo.last);
+        writeKerning(out, fontname, bitcount32, arraySyntax1);
     }
 
-    lastChar = "";
-    foreach (CharInfo *ch, chars)
-    {
-        out << lastChar;
-        if (ch->skip)
-        {
-            out << "0";
-        }
-        else
-        {
-            out << QString("char%1").arg(ch->id);
-        }
-        lastChar = ",\n";
-    }
-    out << "};\n";
-    file.close();
-    return true;
+    return writeFile(filename, out.data(), true);
 }
 
 bool Converter::generateImages(const QString &filename,
@@ -357,151 +1108,315 @@ bool Converter::generateImages(const QString &filename,
                                const QString &arraySyntax1
                                )
 {
-    QFile file(filename);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+    int dataBytes = 0;
+    foreach (ImageInfo *ii, images)
     {
-        return false;
+        dataBytes += ii->byteSize;
     }
-    QTextStream out(&file);
 
+    SourceWriter out(estimateSourceSize(dataBytes, images.size(), includes));
     out << includes << "\n";
 
-    QString lastChar = "";
+    const char *lastChar = "";
     foreach (ImageInfo *ii, images)
     {
         out << lastChar;
 
         // bitmap data
-        QImage img = ii->pixmap.toImage();
-        img = img.convertToFormat(format, Qt::MonoOnly);
+        bool encoded;
+        QByteArray bitmap = outputBitmap(ii->bitmap, format, ii->depth, rle, &encoded);
+        const uchar *data = (const uchar*)bitmap.constData();
+        int byteSize = bitmap.size();
+        int header = headerWidth(ii->width, ii->depth, encoded);
 
-        int byteWidth = (ii->width/8);
-        QString lastChar2 = "";
+        int byteWidth = encoded ? rleLineBytes : (ii->width*ii->depth/8);
         if (bitcount32)
         {
-            int dwordSize = ii->byteSize/4;
-            if (ii->byteSize%4)
+            int dwordSize = byteSize/4;
+            if (byteSize%4)
             {
                 dwordSize++;
             }
-            uint *temp = new uint[dwordSize]();
-            uchar *pTemp = (uchar*)temp;
-            for (int y = 0, i = 0; y < ii->height; y++, i+=byteWidth)
-            {
-                uchar *line = img.scanLine(y);
-                memcpy(pTemp+i, line, byteWidth);
-            }
 
             out << QString(arraySyntax1).arg(ii->name).arg(dwordSize+4) << "\n";
             // header bytes
-            out << QString("%1,%2,%3,0,").arg(ii->width).arg(ii->height).arg(dwordSize*4) << "\n";
-
-            for (int i = 0; i < (dwordSize-1); i++)
-            {
-                out << QString().sprintf("0x%08X,", temp[i]);
-            }
-            out << QString().sprintf("0x%08X", temp[dwordSize-1]);
-
-            delete [] temp;
+            out << header << "," << ii->height << "," << dwordSize*4 << ",0,\n";
+            writeWords(out, data, byteSize, dwordSize);
         }
         else    // 8bit
         {
-            out << QString(arraySyntax1).arg(ii->name).arg(ii->byteSize+4) << "\n";
+            out << QString(arraySyntax1).arg(ii->name).arg(byteSize+4) << "\n";
             // header bytes
-            out << QString("%1,%2,%3,0,").arg(ii->width).arg(ii->height).arg(ii->byteSize) << "\n";
-
-            for (int y = 0; y < ii->height; y++)
-            {
-                out << lastChar2 << "\n";
-                uchar *line = img.scanLine(y);
-                for (int x = 0; x < (byteWidth-1); x++)
-                {
-                    out << QString().sprintf("0x%02X,", line[x]);
-                }
-                out << QString().sprintf("0x%02X", line[byteWidth-1]);
-                lastChar2 = ",";
-            }
+            out << header << "," << ii->height << "," << byteSize << ",0,\n";
+            writeLines(out, data, byteSize, byteWidth);
         }
 
         out << "};";
         lastChar = "\n\n";
     }
     out << "\n\n\n";
+
+    return writeFile(filename, out.data(), true);
+}
+
+bool Converter::writeFile(const QString &filename, const QByteArray &data, bool text)
+{
+    QIODevice::OpenMode textMode = text ? QIODevice::Text : QIODevice::NotOpen;
+    QFile file(filename);
+    if (file.open(QIODevice::ReadOnly | textMode))
+    {
+        // text mode reads native line ends back as \n, so this compares like with like
+        bool same = file.readAll() == data;
+        file.close();
+        if (same)
+        {
+            return true;
+        }
+    }
+
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | textMode))
+    {
+        return false;
+    }
+    bool ok = file.write(data) == data.size();
     file.close();
-    return true;
+    return ok;
+}
+
+static bool writeBlob(const QString &filename, const QByteArray &blob)
+{
+    return Converter::writeFile(filename, blob, false);
+}
+
+static int blobFlags(bool bitcount32, QImage::Format format, int depth)
+{
+    int flags = 0;
+    if (depth == 2)
+    {
+        flags |= BitmapBlob::Gray2;
+    }
+    else if (depth == 4)
+    {
+        flags |= BitmapBlob::Gray4;
+    }
+    if (bitcount32)
+    {
+        flags |= BitmapBlob::Aligned32;
+    }
+    if (format == QImage::Format_MonoLSB)
+    {
+        flags |= BitmapBlob::LsbFirst;
+    }
+    return flags;
+}
+
+bool Converter::generateFontBlob(const QString &filename, bool bitcount32, QImage::Format format)
+{
+    int minYoffset = getMinYoffset();
+
+    QList<BitmapBlob::Record> records;
+    foreach (CharInfo *ch, chars)
+    {
+        BitmapBlob::Record record;
+        if (sparse && ch->skip)
+        {
+            continue;
+        }
+        if (!ch->skip)
+        {
+            record.present = true;
+            record.code = ch->id;
+            record.width = ch->width;
+            record.height = ch->height;
+            record.yoffset = ch->yoffset-minYoffset;
+            bool encoded;
+            record.bitmap = outputBitmap(ch->bitmap, format, ch->depth, rle, &encoded);
+            record.flags = encoded ? BitmapBlob::RleEncoded : 0;
+        }
+        records.append(record);
+    }
+
+    int flags = blobFlags(bitcount32, format, depth);
+    int first = fontInfo.first;
+    if (sparse)
+    {
+        flags |= BitmapBlob::Sparse;
+        first = records.isEmpty() ? 0 : records.first().code;
+    }
+    return writeBlob(filename, BitmapBlob::build(BitmapBlob::Font, first, records, flags));
+}
+
+bool Converter::generateImagesBlob(const QString &filename, bool bitcount32, QImage::Format format)
+{
+    QList<BitmapBlob::Record> records;
+    foreach (ImageInfo *ii, images)
+    {
+        BitmapBlob::Record record;
+        record.present = true;
+        record.width = ii->width;
+        record.height = ii->height;
+        bool encoded;
+        record.bitmap = outputBitmap(ii->bitmap, format, ii->depth, rle, &encoded);
+        record.flags = encoded ? BitmapBlob::RleEncoded : 0;
+        records.append(record);
+    }
+
+    return writeBlob(filename, BitmapBlob::build(BitmapBlob::Images, 0, records,
+                                                 blobFlags(bitcount32, format, depth)));
 }
 
 
 void Converter::recreateCharPic(CharInfo *charInfo, int threshold)
 {
+    int targetWidth;
     if (charInfo->useCustomWidth)
     {
-        charInfo->charPic = createPixmap(fontImage,
-                                       charInfo->attributes.x,
-                                       charInfo->attributes.y,
-                                       charInfo->attributes.width,
-                                       charInfo->attributes.height,
-                                       charInfo->customWidth,
-                                       charInfo->scaled);
+        targetWidth = alignedWidth(charInfo->customWidth);
+        charInfo->scaled = targetWidth < charInfo->attributes.width;
     }
     else
     {
-        charInfo->charPic = createPixmap(fontImage,
-                                       charInfo->attributes.x,
-                                       charInfo->attributes.y,
-                                       charInfo->attributes.width,
-                                       charInfo->attributes.height,
-                                       charInfo->attributes.xadvance,
-                                       threshold,
-                                       charInfo->scaled);
+        targetWidth = Rasterizer::targetWidth(charInfo->attributes.width,
+                                              charInfo->attributes.xadvance,
+                                              threshold,
+                                              charInfo->scaled);
     }
-
-    charInfo->width = charInfo->charPic.width();
-    charInfo->height = charInfo->charPic.height();
-
     int oldSize = charInfo->byteSize;
-    charInfo->byteSize = charInfo->width*charInfo->height/8;
+    int oldTrimmed = trimmedBytes(charInfo);
+    packChar(charInfo, pageImage(charInfo->attributes.page), targetWidth,
+             MonoPacker(atlasChannel, cutoff, atlasInkBelow, false, depth));
+    charInfo->rasterized = true;
+    charInfo->byteSize = charInfo->width*charInfo->depth*charInfo->height/8;
+    charInfo->rleSize = Rle::encode(charInfo->bitmap).size();
 
     if (!charInfo->skip)
     {
         fontInfo.overallSize -= oldSize;
         fontInfo.overallSize += charInfo->byteSize;
+        fontInfo.trimmedBytes -= oldTrimmed;
+        fontInfo.trimmedBytes += trimmedBytes(charInfo);
     }
 }
 
 void Converter::recreateImgPic(ImageInfo *imgInfo, int threshold)
 {
-    QPixmap origImg = QPixmap(imgInfo->srcFile);
+    const QImage &origImg = imgInfo->source;
     if (origImg.isNull())
     {
         return;
     }
 
+    int targetWidth;
     if (imgInfo->useCustomWidth)
     {
-        imgInfo->pixmap = createPixmap(origImg,
-                                     0, 0,
-                                     origImg.width(),
-                                     origImg.height(),
-                                     imgInfo->customWidth,
-                                     imgInfo->scaled);
+        targetWidth = alignedWidth(imgInfo->customWidth);
+        imgInfo->scaled = targetWidth < origImg.width();
     }
     else
     {
-        imgInfo->pixmap = createPixmap(origImg,
-                                     0, 0,
-                                     origImg.width(),
-                                     origImg.height(),
-                                     origImg.width(),
-                                     threshold,
-                                     imgInfo->scaled);
+        targetWidth = Rasterizer::targetWidth(origImg.width(), origImg.width(), threshold, imgInfo->scaled);
+    }
+    QImage image = Rasterizer::paint(origImg, origImg.rect(), targetWidth, imgInfo->scaled);
+
+    imgInfo->bitmap = Rasterizer::packImage(image, depth, dither);
+    imgInfo->width = image.width();
+    imgInfo->height = image.height();
+    imgInfo->depth = depth;
+    imgInfo->byteSize = imgInfo->width*depth*imgInfo->height/8;
+    imgInfo->rleSize = Rle::encode(imgInfo->bitmap).size();
+}
+
+
+void Converter::setCutoff(int cutoff)
+{
+    this->cutoff = cutoff;
+}
+
+void Converter::setRleCompression(bool enabled)
+{
+    rle = enabled;
+}
+
+void Converter::setSparse(bool enabled)
+{
+    sparse = enabled;
+}
+
+void Converter::setKerning(bool enabled)
+{
+    kerning = enabled;
+}
+
+void Converter::setPacked(bool enabled)
+{
+    packed = enabled;
+}
+
+void Converter::setDither(Dither::Method method)
+{
+    dither = method;
+}
+
+bool Converter::setDepth(int bitsPerPixel)
+{
+    if (bitsPerPixel != 2 && bitsPerPixel != 4)
+    {
+        bitsPerPixel = 1;
+    }
+    if (bitsPerPixel == depth)
+    {
+        return true;
     }
+    depth = bitsPerPixel;
 
-    imgInfo->width = imgInfo->pixmap.width();
-    imgInfo->height = imgInfo->pixmap.height();
-    imgInfo->byteSize = imgInfo->width*imgInfo->height/8;
+    QVector<CharInfo*> glyphs;
+    foreach (CharInfo *ch, fontChars)
+    {
+        if (ch->rasterized && ch->useCustomWidth)
+        {
+            recreateCharPic(ch, threshold);
+        }
+        else if (ch->rasterized)
+        {
+            glyphs.append(ch);
+        }
+    }
+    bool ok = rasterizeChars(glyphs);
+    updateFontInfo();
+    return ok;
 }
 
+// Picks the atlas channel that holds the glyphs from the BMFont <common> channel settings
+// (0 = glyph, 1 = outline, 2 = glyph and outline, 3 = zero, 4 = one).
+void Converter::setAtlasChannels(int alphaChnl, int redChnl, int greenChnl, int blueChnl)
+{
+    if (alphaChnl == 0 || alphaChnl == 2)
+    {
+        // coverage in the alpha channel
+        atlasChannel = MonoPacker::Alpha;
+        atlasInkBelow = false;
+        return;
+    }
+
+    // dark glyphs on a light background, as they look when composited onto white
+    atlasInkBelow = true;
+    if (greenChnl == 0 || greenChnl == 2)
+    {
+        atlasChannel = MonoPacker::Green;
+    }
+    else if (redChnl == 0 || redChnl == 2)
+    {
+        atlasChannel = MonoPacker::Red;
+    }
+    else if (blueChnl == 0 || blueChnl == 2)
+    {
+        atlasChannel = MonoPacker::Blue;
+    }
+    else
+    {
+        atlasChannel = MonoPacker::Green;
+    }
+}
 
 void Converter::charIncluded(int index, bool included)
 {
@@ -513,82 +1428,129 @@ void Converter::charIncluded(int index, bool included)
     if (charInfo->skip)
     {
         fontInfo.overallSize -= charInfo->byteSize;
+        fontInfo.trimmedBytes -= trimmedBytes(charInfo);
         fontInfo.used--;
     }
     else
     {
         fontInfo.overallSize += charInfo->byteSize;
+        fontInfo.trimmedBytes += trimmedBytes(charInfo);
         fontInfo.used++;
     }
 }
 
 
-uchar **Converter::getFontData(QImage::Format format)
+FontData Converter::getFontData(QImage::Format format) const
 {
-    int minYoffset = INT_MAX;
-    foreach (CharInfo *ch, chars)
+    int minYoffset = getMinYoffset();
+
+    // records are never bigger than the raw bitmap and their header, so the arena is allocated once
+    int recordBytes = 0;
+    foreach (const CharInfo *ch, chars)
     {
-        if (!ch->skip && ch->attributes.yoffset < minYoffset)
+        if (!ch->skip)
         {
-            minYoffset = ch->attributes.yoffset;
+            recordBytes += 4+ch->bitmap.size();
         }
     }
+    FontData font(sparse, fontInfo.first, sparse ? fontInfo.used : fontInfo.count, recordBytes);
 
-    uchar **fontdata = new uchar*[fontInfo.count+2];
-    fontdata[0] = (uchar*)fontInfo.first;
-    fontdata[1] = (uchar*)fontInfo.last;
-    int chIdx = 2;
-    foreach (CharInfo *ch, chars)
+    int slot = 0;
+    foreach (const CharInfo *ch, chars)
     {
+        if (sparse && ch->skip)
+        {
+            continue;
+        }
         if (!ch->skip)
         {
-            uchar *chdata = new uchar[ch->byteSize+4];
-            chdata[0] = ch->width;
-            chdata[1] = ch->height;
-            chdata[2] = 0;
-            chdata[3] = (ch->attributes.yoffset-minYoffset);
-
-            // bitmap data
-            QImage img = ch->charPic.toImage();
-            img = img.convertToFormat(format, Qt::MonoOnly);
+            bool encoded;
+            QByteArray bitmap = outputBitmap(ch->bitmap, format, ch->depth, rle, &encoded);
+            font.setGlyph(slot, ch->id, headerWidth(ch->width, ch->depth, encoded), ch->height,
+                          ch->yoffset-minYoffset, bitmap);
+        }
+        slot++;
+    }
+    return font;
+}
 
-            int byteWidth = (ch->width/8);
-            for (int y = 0, i = 4; y < ch->height; y++, i+=byteWidth)
-            {
-                uchar *line = img.scanLine(y);
-                memcpy(chdata+i, line, byteWidth);
-            }
-            fontdata[chIdx] = chdata;
+QByteArray Converter::getMetricsData() const
+{
+    QByteArray metrics;
+    foreach (CharInfo *ch, chars)
+    {
+        if (sparse && ch->skip)
+        {
+            continue;
         }
-        else
+        int xoffset = 0;
+        int xadvance = 0;
+        if (!ch->skip)
         {
-            fontdata[chIdx] = 0;
+            xoffset = ch->attributes.xoffset -
+                      Rasterizer::bitmapOffset(ch->attributes.width, ch->width, ch->scaled);
+            xadvance = ch->attributes.xadvance;
         }
-        chIdx++;
+        metrics.append((char)qBound(-128, xoffset, 127));
+        metrics.append((char)qBound(0, xadvance, 255));
     }
-    return fontdata;
+    return metrics;
 }
 
-uchar *Converter::getImageData(int index, QImage::Format format)
+QByteArray Converter::getKerningData() const
 {
-    ImageInfo *imgInfo = images.value(index);
-    if (!imgInfo)
-        return NULL;
-
-    uchar *image = new uchar[imgInfo->byteSize+2];
-    image[0] = imgInfo->width;
-    image[1] = imgInfo->height;
+    QSet<int> included;
+    foreach (CharInfo *ch, chars)
+    {
+        if (!ch->skip)
+        {
+            included.insert(ch->id);
+        }
+    }
 
-    // bitmap data
-    QImage img = imgInfo->pixmap.toImage();
-    img = img.convertToFormat(format, Qt::MonoOnly);
+    QMap<quint32, int> pairs;
+    foreach (const BMFontKerning &k, kernings)
+    {
+        if (k.amount && k.first <= 0xFFFF && k.second <= 0xFFFF &&
+            included.contains(k.first) && included.contains(k.second))
+        {
+            pairs.insert((quint32)k.first << 16 | k.second, qBound(-128, k.amount, 127));
+        }
+    }
 
-    int byteWidth = (imgInfo->width/8);
-    for (int y = 0, i = 2; y < imgInfo->height; y++, i+=byteWidth)
+    int count = qMin(pairs.size(), 0xFFFF);
+    QByteArray data;
+    data.reserve(2+count*5);
+    data.append((char)(count & 0xFF));
+    data.append((char)(count >> 8));
+    QMap<quint32, int>::const_iterator it = pairs.constBegin();
+    for (int i = 0; i < count; i++, ++it)
     {
-        uchar *line = img.scanLine(y);
-        memcpy(image+i, line, byteWidth);
+        quint32 key = it.key();
+        data.append((char)((key >> 16) & 0xFF));
+        data.append((char)(key >> 24));
+        data.append((char)(key & 0xFF));
+        data.append((char)((key >> 8) & 0xFF));
+        data.append((char)it.value());
     }
+    return data;
+}
+
+QByteArray Converter::getImageData(int index, QImage::Format format) const
+{
+    const ImageInfo *imgInfo = images.value(index);
+    if (!imgInfo)
+        return QByteArray();
+
+    // bitmap data
+    bool encoded;
+    QByteArray bitmap = outputBitmap(imgInfo->bitmap, format, imgInfo->depth, rle, &encoded);
+
+    QByteArray image;
+    image.reserve(bitmap.size()+2);
+    image.append((char)headerWidth(imgInfo->width, imgInfo->depth, encoded));
+    image.append((char)imgInfo->height);
+    image.append(bitmap);
     return image;
 }
 
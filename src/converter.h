@@ -2,8 +2,18 @@
 #define CONVERTER_H
 
 #include <QList>
-#include <QPixmap>
-#include <QTextStream>
+#include <QMap>
+#include <QHash>
+#include <QDateTime>
+#include <QByteArray>
+#include <QImage>
+#include <QVector>
+#include "monopacker.h"
+#include "dither.h"
+#include "bmfont.h"
+#include "fontdata.h"
+
+class SourceWriter;
 
 struct FontInfo{
     FontInfo(){
@@ -14,6 +24,7 @@ struct FontInfo{
         count = 0;
         used = 0;
         overallSize = 0;
+        trimmedBytes = 0;
     }
 
     QString name;
@@ -21,6 +32,7 @@ struct FontInfo{
     int first, last;
     int count, used;
     int overallSize;
+    int trimmedBytes;   // bitmap bytes saved by dropping blank rows, included in overallSize already
 };
 
 struct CharInfo{
@@ -28,11 +40,16 @@ struct CharInfo{
         id = 0;
         width = 0;
         height = 0;
+        yoffset = 0;
+        trimmedRows = 0;
+        depth = 1;
         scaled = false;
         byteSize = 0;
+        rleSize = 0;
         skip = true;
         customWidth = 0;
         useCustomWidth = false;
+        rasterized = false;
     }
     struct Attributes{
         Attributes(){
@@ -40,43 +57,62 @@ struct CharInfo{
             y = 0;
             width = 0;
             height = 0;
+            xoffset = 0;
             xadvance = 0;
             yoffset = 0;
+            page = 0;
         }
-        int x, y, width, height, xadvance, yoffset;
+        int x, y, width, height, xoffset, xadvance, yoffset;
+        int page;
     };
     Attributes attributes;
 
     int id;
     int width, height;
+    int yoffset;        // of the first bitmap row: attributes.yoffset plus the blank rows trimmed above the ink
+    int trimmedRows;    // blank rows dropped above and below the ink
+    int depth;          // bits per pixel of the bitmap
     bool scaled;
     int byteSize;
+    int rleSize;        // bytes of the run-length encoded bitmap
     bool skip;
     int customWidth;
     bool useCustomWidth;
-    QPixmap charPic;
+    bool rasterized;    // glyphs outside the char range are rasterized when they enter it
+    QByteArray bitmap;  // packed rows of width/8 bytes, MSB first, set bit = black pixel
+                        // gray: width*depth/8 bytes per row, leftmost pixel in the high bits, 0 = white
 };
 
 struct ImageInfo{
     ImageInfo(){
         width = 0;
         height = 0;
+        depth = 1;
         scaled = false;
         byteSize = 0;
+        rleSize = 0;
         customWidth = 0;
         useCustomWidth = false;
     }
 
     int width, height;
+    int depth;
     bool scaled;
     int byteSize;
+    int rleSize;
     int customWidth;
     bool useCustomWidth;
-    QPixmap pixmap;
+    QByteArray bitmap;  // same layout as CharInfo::bitmap
+    QImage source;      // decoded srcFile, so width and setting changes do not read the file again
     QString srcFile;
     QString name;
 };
 
+struct AtlasPage{
+    QDateTime modified;
+    QImage image;       // Format_ARGB32
+};
+
 
 class Converter
 {
@@ -92,8 +128,25 @@ public:
     const QStringList &getImgFiles() { return imgFiles; }
 
     bool openFont(const QString &filename, int threshold, int firstChar, int lastChar);
+
+    // The parsed glyphs and the atlas stay in memory, so these only recompute what changes.
+    // setThreshold() re-rasterizes the glyphs whose target width changes and returns their indexes in getChars().
+    // setCharRange() rasterizes the glyphs that enter the range, decoding only the atlas pages they
+    // are on, and returns false if one of those pages cannot be read.
+    QList<int> setThreshold(int threshold);
+    bool setCharRange(int firstChar, int lastChar);
     bool openImage(const QString &filename, int threshold);
 
+    // Watch mode. getFontFiles() lists the .fnt file of the open font followed by its atlas pages.
+    // reloadFontFiles() re-reads changed font files: a changed .fnt reopens the whole font with the
+    // same threshold and char range, and the glyphs keep whether they are included and their custom
+    // widths; a changed page re-rasterizes only the glyphs on it. It returns
+    // the indexes in getChars() of the glyphs that were regenerated and sets ok to false if a file
+    // cannot be read. reloadImages() re-reads changed image files and returns their indexes in getImages().
+    QStringList getFontFiles() const;
+    QList<int> reloadFontFiles(const QStringList &files, bool *ok);
+    QList<int> reloadImages(const QStringList &files, int threshold, bool *ok);
+
     bool generateFont(const QString &filename,
                       const QString &fontname,
                       const QString &includes,
@@ -108,23 +161,114 @@ public:
                         QImage::Format format,
                         const QString &arraySyntax1);
 
+    // Binary blobs, see BitmapBlob for the layout
+    bool generateFontBlob(const QString &filename, bool bitcount32, QImage::Format format);
+    bool generateImagesBlob(const QString &filename, bool bitcount32, QImage::Format format);
+
     void recreateCharPic(CharInfo *charInfo, int threshold);
     void recreateImgPic(ImageInfo *imgInfo, int threshold);
 
     void charIncluded(int index, bool included);
 
+    // Bitmap bytes the generated font does not need because identical glyphs share one array
+    int getSharedBytes() const;
+
+    // Channel value at which an atlas pixel becomes a set bit, 1-255
+    void setCutoff(int cutoff);
+
+    // Run-length encode bitmaps that get smaller by it, in the generated files and in
+    // getFontData()/getImageData(). Encoded bitmaps have bit 0 of the width header set.
+    void setRleCompression(bool enabled);
+
+    // Sparse fonts have no placeholders for missing ids in getChars(), and the generated table lists
+    // only the included glyphs as code,glyph pairs sorted by code. Takes effect with the next setCharRange().
+    void setSparse(bool enabled);
+    bool isSparse() const { return sparse; }
+
+    // Emits the glyph metrics and the kerning pairs of the font with the generated font, so text
+    // can be laid out with xadvance and kerning instead of the bitmap widths.
+    void setKerning(bool enabled);
+
+    // Packed fonts are one array with a 16 bit offset table instead of an array per glyph and a
+    // pointer table: no pointers, no relocations, and the font can be placed anywhere in flash.
+    // generateFont() fails if the font is too big for 16 bit offsets.
+    void setPacked(bool enabled);
+    bool isPacked() const { return packed; }
+    bool hasKerning() const { return kerning; }
+
+    // Bits per pixel of the bitmaps: 1, or 2 and 4 for grayscale controllers like the SSD1322
+    // and SSD1327, which get the anti-aliased coverage of the atlas as gray levels. Bit 1 and 2
+    // of the width header hold log2 of it. Re-rasterizes the glyphs of the open font and returns
+    // false if a page cannot be read; images take it with the next openImage().
+    bool setDepth(int bitsPerPixel);
+    int getDepth() const { return depth; }
+
+    // How images are reduced to the levels of the depth, takes effect with the next openImage().
+    void setDither(Dither::Method method);
+    Dither::Method getDither() const { return dither; }
+
     void clearChars();
     void clearImages();
 
-    uchar **getFontData(QImage::Format format);
-    uchar *getImageData(int index, QImage::Format format);
+    // The preview font in one arena, see FontData. Same layout as the generated font table:
+    // first, last and a glyph per id, or for sparse fonts the glyph count followed by code,glyph pairs.
+    FontData getFontData(QImage::Format format) const;
+    // The 2 byte image header (width, height) followed by the bitmap, empty for an invalid index.
+    QByteArray getImageData(int index, QImage::Format format) const;
+
+    // Two bytes per font table slot: the signed x offset of the bitmap from the pen position and the xadvance.
+    QByteArray getMetricsData() const;
+    // Pair count (u16), then first (u16), second (u16) and a signed amount byte per pair, sorted by
+    // first and second. Only pairs of included glyphs in the Basic Multilingual Plane are kept.
+    QByteArray getKerningData() const;
+
+    static QImage bitmapToImage(const QByteArray &bitmap, int width, int height, int depth = 1);
+
+    // Writes data to filename unless the file holds exactly that already, so its timestamp only
+    // changes with its content and make does not rebuild for nothing. The generate functions
+    // write through it. text: native line ends on disk, like QIODevice::Text.
+    static bool writeFile(const QString &filename, const QByteArray &data, bool text);
 
 private:
-    QPixmap fontImage;
+    bool loadFont(const QString &filename, int threshold, int firstChar, int lastChar,
+                  const QMap<int, CharInfo*> &kept);
+    void setAtlasChannels(int alphaChnl, int redChnl, int greenChnl, int blueChnl);
+    QImage pageImage(int page);
+    bool rasterizeChars(const QVector<CharInfo*> &glyphs);
+    void updateFontInfo();
+    int charIndex(int id) const;
+    void writeSparseTable(SourceWriter &out, const QString &fontname, bool bitcount32,
+                          const QString &arraySyntax2, const QVector<int> &owners);
+    bool packFont(bool bitcount32, QImage::Format format, int minYoffset,
+                  const QVector<int> &owners, QByteArray *blob) const;
+    void writePackedFont(SourceWriter &out, const QString &fontname, bool bitcount32,
+                         const QString &arraySyntax1, const QByteArray &blob);
+    void writeKerning(SourceWriter &out, const QString &fontname, bool bitcount32,
+                      const QString &arraySyntax1);
+    int getMinYoffset() const;
+    QVector<int> sharedChars(int minYoffset) const;
+
+    QString fontFile;
+    int firstChar, lastChar;
+    QMap<int, QString> pageFiles;       // atlas page id -> image file
+    QHash<QString, AtlasPage> pageCache;    // decoded pages by file, kept across reopens
+    MonoPacker::Channel atlasChannel;
+    bool atlasInkBelow;
+    int cutoff;
+    int threshold;
+    bool rle;
+    bool sparse;
+    bool kerning;
+    bool packed;
+    int depth;
+    Dither::Method dither;
     QStringList imgFiles;
 
     FontInfo fontInfo;
-    QList<CharInfo*> chars;
+    QList<CharInfo*> chars;             // firstChar..lastChar, owned by fontChars or missingChars
+    QMap<int, CharInfo*> fontChars;     // every glyph of the font by id
+    QMap<int, CharInfo*> missingChars;  // placeholders for ids in the range without a glyph
+    QVector<BMFontKerning> kernings;
     QList<ImageInfo*> images;
 };
 
@@ -0,0 +1,32 @@
+# Conversion core shared by the GUI and the command-line targets
+
+INCLUDEPATH += $$PWD
+DEPENDPATH += $$PWD
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += concurrent
+
+SOURCES += $$PWD/converter.cpp \
+    $$PWD/monopacker.cpp \
+    $$PWD/dither.cpp \
+    $$PWD/rasterizer.cpp \
+    $$PWD/sourcewriter.cpp \
+    $$PWD/outputpreset.cpp \
+    $$PWD/bitmapblob.cpp \
+    $$PWD/rle.cpp \
+    $$PWD/conversioncache.cpp \
+    $$PWD/sourcewatcher.cpp \
+    $$PWD/fontdata.cpp \
+    $$PWD/bmfont.cpp
+
+HEADERS += $$PWD/converter.h \
+    $$PWD/monopacker.h \
+    $$PWD/dither.h \
+    $$PWD/rasterizer.h \
+    $$PWD/sourcewriter.h \
+    $$PWD/outputpreset.h \
+    $$PWD/bitmapblob.h \
+    $$PWD/rle.h \
+    $$PWD/conversioncache.h \
+    $$PWD/sourcewatcher.h \
+    $$PWD/fontdata.h \
+    $$PWD/bmfont.h
@@ -0,0 +1,261 @@
+#include "dither.h"
+#include <QAtomicInt>
+#include <QThread>
+#include <QVector>
+#include <QtConcurrent>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define DITHER_SSE2
+#    include <emmintrin.h>
+#  endif
+#endif
+
+
+static const uchar bayer8[8][8] = {
+    {  0, 32,  8, 40,  2, 34, 10, 42 },
+    { 48, 16, 56, 24, 50, 18, 58, 26 },
+    { 12, 44,  4, 36, 14, 46,  6, 38 },
+    { 60, 28, 52, 20, 62, 30, 54, 22 },
+    {  3, 35, 11, 43,  1, 33,  9, 41 },
+    { 51, 19, 59, 27, 49, 17, 57, 25 },
+    { 15, 47,  7, 39, 13, 45,  5, 37 },
+    { 63, 31, 55, 23, 61, 29, 53, 21 }
+};
+
+// Bayer matrix entry spread over 0-254, added to the scaled ink before it is cut to a level.
+static inline int bayerOffset(int x, int y)
+{
+    return (2*bayer8[y & 7][x & 7]+1)*255/128;
+}
+
+// v/255 rounded down, exact for 0 <= v < 65535
+static inline int div255(int v)
+{
+    return (v + (v >> 8) + 1) >> 8;
+}
+
+// Ordered dithering works on the ink (255-gray) of a pixel: level = (ink*levels + offset)/255.
+static void bayerRow(uchar *row, int from, int count, int y, int levels)
+{
+    int step = 255/levels;
+    for (int x = from; x < count; x++)
+    {
+        int level = div255((255-row[x])*levels + bayerOffset(x, y));
+        row[x] = 255 - level*step;
+    }
+}
+
+#ifdef DITHER_SSE2
+// Ink of the dithered level for 8 pixels in 16-bit lanes.
+static inline __m128i bayerLanes(__m128i ink, __m128i offsets, __m128i levels, __m128i step)
+{
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i v = _mm_add_epi16(_mm_mullo_epi16(ink, levels), offsets);
+    __m128i level = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), one), 8);
+    return _mm_mullo_epi16(level, step);
+}
+
+// Dithers 16 pixels at a time, returns the number of pixels done.
+static int bayerRowSse2(uchar *row, int count, int y, int levels)
+{
+    // the matrix repeats every 8 pixels, so one vector holds the offsets of every block
+    uchar offsets[16];
+    for (int i = 0; i < 16; i++)
+    {
+        offsets[i] = bayerOffset(i, y);
+    }
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i white = _mm_set1_epi8((char)0xFF);
+    const __m128i offsetBytes = _mm_loadu_si128((const __m128i*)offsets);
+    const __m128i offsetsLo = _mm_unpacklo_epi8(offsetBytes, zero);
+    const __m128i offsetsHi = _mm_unpackhi_epi8(offsetBytes, zero);
+    const __m128i levelCount = _mm_set1_epi16(levels);
+    const __m128i step = _mm_set1_epi16(255/levels);
+
+    int done = 0;
+    for (; done + 16 <= count; done += 16)
+    {
+        __m128i *p = (__m128i*)(row + done);
+        __m128i ink = _mm_xor_si128(_mm_loadu_si128(p), white);
+        __m128i lo = bayerLanes(_mm_unpacklo_epi8(ink, zero), offsetsLo, levelCount, step);
+        __m128i hi = bayerLanes(_mm_unpackhi_epi8(ink, zero), offsetsHi, levelCount, step);
+        // the ink of a level is at most 255, so 255-ink is a plain xor
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_packus_epi16(lo, hi), white));
+    }
+    return done;
+}
+#endif
+
+
+// Pixels per step of the row progress that the row below waits for.
+static const int blockPixels = 64;
+
+// Error diffusion of one row. Errors for the pixels to the right are carried along, errors
+// for the rows below go to their line in errors, which sums them in sixteenths (Floyd-Steinberg)
+// or eighths (Atkinson). A row starts a block once the row above is done with every pixel
+// that spreads error into it, and publishes its progress after every block.
+static void diffuseRow(uchar *row, int y, int width, int height, int levels, bool atkinson,
+                       int *errors, QAtomicInt *progress)
+{
+    int shift = atkinson ? 3 : 4;
+    int step = 255/levels;
+    int *own = errors + y*width;
+    int *below = y+1 < height ? errors + (y+1)*width : NULL;
+    int *below2 = atkinson && y+2 < height ? errors + (y+2)*width : NULL;
+    int carry1 = 0;     // error for x+1
+    int carry2 = 0;     // error for x+2
+
+    for (int x0 = 0; x0 < width; x0 += blockPixels)
+    {
+        int x1 = qMin(width, x0+blockPixels);
+        if (y > 0)
+        {
+            int needed = qMin(width, x1+1);
+            while (progress[y-1].loadAcquire() < needed)
+            {
+                QThread::yieldCurrentThread();
+            }
+        }
+
+        for (int x = x0; x < x1; x++)
+        {
+            int value = 255-row[x] + ((own[x] + carry1 + (1 << (shift-1))) >> shift);
+            carry1 = carry2;
+            carry2 = 0;
+            int level = qBound(0, (value*levels + 127)/255, levels);
+            int error = value - level*step;
+            row[x] = 255 - level*step;
+            if (!error)
+            {
+                continue;
+            }
+
+            if (atkinson)
+            {
+                // 1/8 to each of six neighbours, the other 2/8 are dropped
+                carry1 += error;
+                carry2 += error;
+                if (below)
+                {
+                    if (x > 0)
+                    {
+                        below[x-1] += error;
+                    }
+                    below[x] += error;
+                    if (x+1 < width)
+                    {
+                        below[x+1] += error;
+                    }
+                }
+                if (below2)
+                {
+                    below2[x] += error;
+                }
+            }
+            else
+            {
+                carry1 += 7*error;
+                if (below)
+                {
+                    if (x > 0)
+                    {
+                        below[x-1] += 3*error;
+                    }
+                    below[x] += 5*error;
+                    if (x+1 < width)
+                    {
+                        below[x+1] += error;
+                    }
+                }
+            }
+        }
+        progress[y].storeRelease(x1);
+    }
+}
+
+// Row worker for the thread pool. Rows are taken in order, so the row above the one a
+// worker waits for is always being worked on.
+struct DiffuseRows{
+    typedef void result_type;
+
+    DiffuseRows(uchar *bits, int bytesPerLine, int width, int height, int levels, bool atkinson,
+                int *errors, QAtomicInt *progress, QAtomicInt *nextRow):
+        bits(bits), bytesPerLine(bytesPerLine), width(width), height(height), levels(levels),
+        atkinson(atkinson), errors(errors), progress(progress), nextRow(nextRow)
+    {
+    }
+
+    void operator()(int worker) const
+    {
+        Q_UNUSED(worker);
+        int y;
+        while ((y = nextRow->fetchAndAddOrdered(1)) < height)
+        {
+            diffuseRow(bits + y*bytesPerLine, y, width, height, levels, atkinson, errors, progress);
+        }
+    }
+
+    uchar *bits;
+    int bytesPerLine;
+    int width, height;
+    int levels;
+    bool atkinson;
+    int *errors;
+    QAtomicInt *progress;
+    QAtomicInt *nextRow;
+};
+
+
+Dither::Dither(Method method, int depth):
+    method(method),
+    depth(depth == 2 || depth == 4 ? depth : 1),
+    isa(MonoPacker::bestIsa()),
+    threads(QThread::idealThreadCount())
+{
+}
+
+void Dither::setIsa(MonoPacker::Isa isa)
+{
+    this->isa = qMin(isa, MonoPacker::bestIsa());
+}
+
+void Dither::setThreads(int threads)
+{
+    this->threads = qMax(1, threads);
+}
+
+void Dither::apply(QImage &gray) const
+{
+    if (method == Threshold || gray.format() != QImage::Format_Grayscale8 || gray.isNull())
+    {
+        return;
+    }
+    int levels = (1 << depth)-1;
+
+    if (method == Bayer)
+    {
+        for (int y = 0; y < gray.height(); y++)
+        {
+            uchar *row = gray.scanLine(y);
+            int done = 0;
+#ifdef DITHER_SSE2
+            if (isa >= MonoPacker::SSE2)
+            {
+                done = bayerRowSse2(row, gray.width(), y, levels);
+            }
+#endif
+            bayerRow(row, done, gray.width(), y, levels);
+        }
+        return;
+    }
+
+    QVector<int> errors(gray.width()*gray.height(), 0);
+    QVector<QAtomicInt> progress(gray.height());
+    QAtomicInt nextRow(0);
+    QVector<int> workers(qMin(threads, gray.height()));
+    // bits() detaches the image before the workers write to it
+    QtConcurrent::blockingMap(workers, DiffuseRows(gray.bits(), gray.bytesPerLine(), gray.width(), gray.height(),
+                                                   levels, method == Atkinson,
+                                                   errors.data(), progress.data(), &nextRow));
+}
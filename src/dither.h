@@ -0,0 +1,37 @@
+#ifndef DITHER_H
+#define DITHER_H
+
+#include <QImage>
+#include "monopacker.h"
+
+// Reduces the luminance of an image to the gray levels of a bitmap depth, so gradients keep
+// their tone instead of turning into blobs: Floyd-Steinberg or Atkinson error diffusion, or
+// ordered dithering with an 8x8 Bayer matrix.
+// Error diffusion runs on several rows at once, every row a block behind the one above it.
+// Ordered dithering has no dependencies between pixels and is vectorized with SSE2.
+class Dither
+{
+public:
+    enum Method{
+        Threshold = 0, FloydSteinberg, Atkinson, Bayer
+    };
+
+    Dither(Method method = Threshold, int depth = 1);
+
+    // Dithers a Format_Grayscale8 image in place. Afterwards every pixel is one of the
+    // 2^depth levels 255-level*255/(2^depth-1), which MonoPacker packs exactly.
+    // Threshold leaves the image as it is, the packer thresholds it.
+    void apply(QImage &gray) const;
+
+    void setIsa(MonoPacker::Isa isa);   // for benchmarks, defaults to MonoPacker::bestIsa()
+    void setThreads(int threads);       // for benchmarks, defaults to QThread::idealThreadCount()
+
+private:
+    Method method;
+    int depth;
+    MonoPacker::Isa isa;
+    int threads;
+};
+
+
+#endif // DITHER_H
@@ -1,26 +1,13 @@
 #-------------------------------------------------
 #
-# Project created by QtCreator 2013-10-12T21:08:58
+# fontConverter       - GUI application (gui.pro)
+# fontConverterCli    - headless batch converter (cli/cli.pro)
+# fontConverterBench  - benchmarks (bench/bench.pro)
 #
 #-------------------------------------------------
 
-QT       += core gui xml
+TEMPLATE = subdirs
 
-greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
-
-TARGET = fontConverter
-TEMPLATE = app
-
-
-SOURCES += main.cpp\
-        mainwindow.cpp \
-    glcd.cpp \
-    glcdscene.cpp \
-    converter.cpp
-
-HEADERS  += mainwindow.h \
-    glcd.h \
-    glcdscene.h \
-    converter.h
-
-FORMS    += mainwindow.ui
+SUBDIRS += gui.pro \
+    cli \
+    bench
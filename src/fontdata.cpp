@@ -0,0 +1,64 @@
+#include "fontdata.h"
+#include <string.h>
+
+
+FontData::FontData():
+    sparse(false),
+    slots(0)
+{
+}
+
+FontData::FontData(bool sparse, uint first, int slots, int recordBytes):
+    sparse(sparse),
+    slots(slots)
+{
+    int tableBytes = (sparse ? 1+2*slots : 2+slots)*sizeof(quint32);
+    arena.reserve(tableBytes+recordBytes);
+    arena.resize(tableBytes);
+    quint32 *table = (quint32*)arena.data();
+    memset(table, 0, tableBytes);
+    if (sparse)
+    {
+        table[0] = slots;
+    }
+    else
+    {
+        table[0] = first;
+        table[1] = first+slots-1;
+    }
+}
+
+const uchar *FontData::glyph(int slot) const
+{
+    if (slot < 0 || slot >= slots)
+    {
+        return NULL;
+    }
+    uint offset = entry(sparse ? 2+2*slot : 2+slot);
+    return offset ? (const uchar*)arena.constData()+offset : NULL;
+}
+
+void FontData::setGlyph(int slot, uint code, int headerWidth, int height, int yoffset, const QByteArray &bitmap)
+{
+    if (slot < 0 || slot >= slots)
+    {
+        return;
+    }
+    int offset = arena.size();
+    arena.append((char)headerWidth);
+    arena.append((char)height);
+    arena.append((char)0);
+    arena.append((char)yoffset);
+    arena.append(bitmap);
+
+    quint32 *table = (quint32*)arena.data();
+    if (sparse)
+    {
+        table[1+2*slot] = code;
+        table[2+2*slot] = offset;
+    }
+    else
+    {
+        table[2+slot] = offset;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef FONTDATA_H
+#define FONTDATA_H
+
+#include <QByteArray>
+
+// Table font for the preview, built by Converter::getFontData() and drawn by Glcd. The header,
+// the glyph table and all glyph records live in one arena that is freed as a whole, and copies
+// share it. Same layout as the generated font table, with offsets instead of pointers:
+// dense fonts: first, last (u32) and a record offset (u32) per code from first to last,
+// sparse fonts: the glyph count (u32) and code,offset pairs (u32 each) sorted by code.
+// A record is the 4 byte glyph header followed by the bitmap, offset 0 is no glyph.
+class FontData
+{
+public:
+    FontData();
+    // slots: codes from first on (dense) or glyphs (sparse). recordBytes reserves room for
+    // the records, so adding them does not grow the arena.
+    FontData(bool sparse, uint first, int slots, int recordBytes);
+
+    bool isNull() const { return arena.isEmpty(); }
+    bool isSparse() const { return sparse; }
+    int count() const { return slots; }
+    uint first() const { return entry(0); }     // dense
+    uint last() const { return entry(1); }      // dense
+    uint code(int slot) const { return sparse ? entry(1+2*slot) : first()+slot; }
+    const uchar *glyph(int slot) const;         // the record, NULL for no glyph
+    int size() const { return arena.size(); }
+
+    // Appends a record and points the table slot at it, sparse fonts also get its code.
+    void setGlyph(int slot, uint code, int headerWidth, int height, int yoffset, const QByteArray &bitmap);
+
+private:
+    uint entry(int index) const { return ((const quint32*)arena.constData())[index]; }
+
+    QByteArray arena;
+    bool sparse;
+    int slots;
+};
+
+
+#endif // FONTDATA_H
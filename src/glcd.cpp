@@ -1,37 +1,168 @@
 #include "glcd.h"
-#include <QPainter>
+#include "bitmapblob.h"
+#include "rle.h"
+#include <QColor>
 #include <QDebug>
+#include <limits.h>
 
 
-Glcd::Glcd(int width, int height, int pixelWidth, int pixelHeight, int spaceWidth, int spaceHeight):
+static quint32 reverseBits(quint32 v)
+{
+    v = (v >> 16) | (v << 16);
+    v = (v & 0xFF00FF00) >> 8 | (v & 0x00FF00FF) << 8;
+    v = (v & 0xF0F0F0F0) >> 4 | (v & 0x0F0F0F0F) << 4;
+    v = (v & 0xCCCCCCCC) >> 2 | (v & 0x33333333) << 2;
+    v = (v & 0xAAAAAAAA) >> 1 | (v & 0x55555555) << 1;
+    return v;
+}
+
+// Reverses the order of the pixels of depth bits in a chunk, the bits of a pixel keep their order.
+static quint32 reversePixels(quint32 v, int depth)
+{
+    v = reverseBits(v);
+    if (depth >= 2)
+    {
+        v = (v & 0xAAAAAAAA) >> 1 | (v & 0x55555555) << 1;
+    }
+    if (depth == 4)
+    {
+        v = (v & 0xCCCCCCCC) >> 2 | (v & 0x33333333) << 2;
+    }
+    return v;
+}
+
+// Shift of pixel x within its byte in a row of depth bits per pixel.
+static inline int pixelShift(int x, int depth, bool lsbFirst)
+{
+    int bit = (x*depth) & 7;
+    return lsbFirst ? bit : 8-depth-bit;
+}
+
+// Gray levels of a bitmap scaled to another depth and bit order, for bitmaps that do not
+// match the display.
+static QByteArray convertDepth(const uchar *src, int width, int height, int srcDepth, bool srcLsbFirst,
+                               int dstDepth, bool dstLsbFirst)
+{
+    int srcBytes = width*srcDepth/8;
+    int dstBytes = width*dstDepth/8;
+    int srcMax = (1 << srcDepth)-1;
+    int dstMax = (1 << dstDepth)-1;
+    QByteArray converted(dstBytes*height, 0);
+    uchar *dst = (uchar*)converted.data();
+    for (int y = 0; y < height; y++, src += srcBytes, dst += dstBytes)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            int level = (src[x*srcDepth/8] >> pixelShift(x, srcDepth, srcLsbFirst)) & srcMax;
+            level = (level*dstMax + srcMax/2)/srcMax;
+            dst[x*dstDepth/8] |= level << pixelShift(x, dstDepth, dstLsbFirst);
+        }
+    }
+    return converted;
+}
+
+// Depth of a bitmap from its width header, see Converter::setDepth().
+static inline int headerDepth(uchar header)
+{
+    return 1 << ((header >> 1) & 3);
+}
+
+// A chunk holds up to 32 pixels of a packed row in the bit order of the row:
+// the first pixel in bit 31 for MSB-first rows, in bit 0 for LSB-first rows.
+static inline quint32 chunkMask(int n, bool lsbFirst)
+{
+    if (n >= 32)
+    {
+        return 0xFFFFFFFF;
+    }
+    return lsbFirst ? (1u << n)-1 : ~(0xFFFFFFFFu >> n);
+}
+
+// Reads n pixels starting at pixel pos of a packed row.
+static inline quint32 readChunk(const uchar *src, int pos, int n, bool lsbFirst)
+{
+    const uchar *p = src + (pos >> 3);
+    int shift = pos & 7;
+    int bytes = (shift+n+7) >> 3;
+    quint64 v = 0;
+    if (lsbFirst)
+    {
+        for (int i = 0; i < bytes; i++)
+        {
+            v |= (quint64)p[i] << (i*8);
+        }
+        return (quint32)(v >> shift) & chunkMask(n, true);
+    }
+    for (int i = 0; i < bytes; i++)
+    {
+        v |= (quint64)p[i] << (56-i*8);
+    }
+    return (quint32)((v << shift) >> 32) & chunkMask(n, false);
+}
+
+// Writes n pixels of a chunk to a packed row at pixel pos, the pixels around them are kept.
+static inline void writeChunk(uchar *dst, int pos, quint32 bits, int n, bool lsbFirst, Glcd::BlitMode mode)
+{
+    uchar *p = dst + (pos >> 3);
+    int shift = pos & 7;
+    int bytes = (shift+n+7) >> 3;
+    quint32 mask = chunkMask(n, lsbFirst);
+    quint64 v, m;
+    if (lsbFirst)
+    {
+        v = (quint64)bits << shift;
+        m = (quint64)mask << shift;
+    }
+    else
+    {
+        v = ((quint64)bits << 32) >> shift;
+        m = ((quint64)mask << 32) >> shift;
+    }
+    for (int i = 0; i < bytes; i++)
+    {
+        int byteShift = lsbFirst ? i*8 : 56-i*8;
+        uchar b = (uchar)(v >> byteShift);
+        switch (mode)
+        {
+        case Glcd::Or:
+            p[i] |= b;
+            break;
+        case Glcd::Xor:
+            p[i] ^= b;
+            break;
+        default:
+            p[i] = (p[i] & ~(uchar)(m >> byteShift)) | b;
+            break;
+        }
+    }
+}
+
+
+Glcd::Glcd(int width, int height, int pixelWidth, int pixelHeight, int spaceWidth, int spaceHeight,
+           Layout layout, int stride):
     image(NULL),
-    width(width), height(height), memWidth(width/8),
+    width(width), height(height),
+    layout(layout),
+    depth(layout == Gray2Rows ? 2 : layout == Gray4Rows ? 4 : 1),
     pixelWidth(pixelWidth), pixelHeight(pixelHeight),
     spaceWidth(spaceWidth), spaceHeight(spaceHeight)
 {
-    mem = new uchar*[height];
-    for (int i = 0; i < height; i++)
-    {
-        mem[i] = new uchar[memWidth]();
-    }
-    font = NULL;
+    int minStride = layout == VerticalPages ? width : (width*depth+7)/8;
+    int rows = layout == VerticalPages ? (height+7)/8 : height;
+    this->stride = qMax(stride, minStride);
+    memSize = this->stride*rows;
+    mem = new uchar[memSize]();
+    fontBlob = NULL;
+    blitMode = Copy;
 
-    painter = new QPainter;
     createImage();
     renderMem();
 }
 
 Glcd::~Glcd()
 {
-    for (int i = 0; i < height; i++)
-    {
-        delete [] mem[i];
-    }
     delete [] mem;
-
-    setFont(NULL);
-
-    delete painter;
+    delete fontBlob;
     delete image;
 }
 
@@ -42,6 +173,12 @@ void Glcd::createImage()
     int imgHeight = height*(pixelHeight+spaceHeight)+spaceHeight;
     image = new QImage(imgWidth, imgHeight, QImage::Format_RGB32);
     image->fill(Qt::white);
+    markDirty(QRect(0, 0, width, height));
+}
+
+void Glcd::markDirty(const QRect &rect)
+{
+    dirty |= rect;
 }
 
 void Glcd::setPixelSize(int pixWidth, int pixHeight)
@@ -62,146 +199,468 @@ void Glcd::setSpaceSize(int sWidth, int sHeight)
 
 void Glcd::fillMem(uchar data)
 {
-    for (int i = 0; i < height; i++)
-    {
-        memset(mem[i], data, memWidth);
-    }
+    memset(mem, data, memSize);
+    markDirty(QRect(0, 0, width, height));
 }
 
-void Glcd::renderMem()
+QRect Glcd::renderMem()
 {
-    painter->begin(image);
-    for (int y = 0; y < height; y++)
+    QRect rect = dirty & QRect(0, 0, width, height);
+    dirty = QRect();
+    if (rect.isEmpty())
     {
-        for (int x = 0; x < memWidth; x++)
+        return QRect();
+    }
+
+    // gray levels from off (0) to black
+    const QColor off = QColor(Qt::lightGray);
+    int maxLevel = (1 << depth)-1;
+    QRgb colors[16];
+    for (int level = 0; level <= maxLevel; level++)
+    {
+        int scale = maxLevel-level;
+        colors[level] = qRgb(off.red()*scale/maxLevel, off.green()*scale/maxLevel, off.blue()*scale/maxLevel);
+    }
+    int cellWidth = pixelWidth+spaceWidth;
+    int cellHeight = pixelHeight+spaceHeight;
+    int imgX = rect.x()*cellWidth+spaceWidth;
+    int imgWidth = rect.width()*cellWidth-spaceWidth;
+    uchar *bits = image->bits();
+    int bytesPerLine = image->bytesPerLine();
+
+    // the spaces between the pixels keep the background of createImage()
+    for (int y = rect.top(); y <= rect.bottom(); y++)
+    {
+        uchar *firstRow = bits + (y*cellHeight+spaceHeight)*bytesPerLine;
+        QRgb *line = (QRgb*)firstRow;
+        for (int x = rect.left(); x <= rect.right(); x++)
         {
-            for (int bitNum = 0; bitNum < 8; bitNum++)
+            QRgb color = colors[memPixel(x, y)];
+            QRgb *px = line + x*cellWidth+spaceWidth;
+            for (int i = 0; i < pixelWidth; i++)
             {
-                int bitMask = 1<<(7-bitNum);
-                bool color = (mem[y][x] & bitMask) != 0;
-                renderPixel(x*8+bitNum, y, color);
+                px[i] = color;
             }
         }
+        // the other rows of a pixel are copies of the first one
+        for (int row = 1; row < pixelHeight; row++)
+        {
+            memcpy(firstRow + row*bytesPerLine + imgX*4, firstRow + imgX*4, imgWidth*4);
+        }
     }
-    painter->end();
+    return QRect(imgX, rect.y()*cellHeight+spaceHeight, imgWidth, rect.height()*cellHeight-spaceHeight);
 }
 
-void Glcd::renderPixel(int x, int y, bool color)
+int Glcd::memPixel(int x, int y) const
 {
-    int rectX = x*(pixelWidth+spaceWidth)+spaceWidth;
-    int rectY = y*(pixelHeight+spaceHeight)+spaceHeight;
-    QColor rectColor(color ? Qt::black : Qt::lightGray);
-    painter->fillRect(rectX, rectY, pixelWidth, pixelHeight, QBrush(rectColor));
+    if (layout == VerticalPages)
+    {
+        return (mem[(y/8)*stride + x] >> (y%8)) & 1;
+    }
+    return (mem[y*stride + x*depth/8] >> pixelShift(x, depth, layout == RowsLsbFirst)) & ((1 << depth)-1);
 }
 
 void Glcd::printMem()
 {
     QString debugStr;
-    for (int i = 0; i < height; i++)
+    for (int i = 0; i < memSize/stride; i++)
     {
-        for (int j = 0; j < memWidth; j++)
+        for (int j = 0; j < stride; j++)
         {
-            debugStr += QString().sprintf("%02x ", mem[i][j]&0xFF);
+            debugStr += QString().sprintf("%02x ", mem[i*stride+j]);
         }
         debugStr += "\n";
     }
     qDebug() << debugStr;
 }
 
-void Glcd::setFont(uchar **newFont)
+void Glcd::setFont(const FontData &newFont)
+{
+    font = newFont;
+    metrics.clear();
+    kerning.clear();
+
+    delete fontBlob;
+    fontBlob = NULL;
+}
+
+void Glcd::setMetrics(const QByteArray &metrics, const QByteArray &kerning)
 {
-    if (font)
+    this->metrics = metrics;
+    this->kerning = kerning;
+}
+
+void Glcd::setFont(BitmapBlob *newFont)
+{
+    setFont(FontData());
+    fontBlob = newFont;
+}
+
+void Glcd::drawBitmap(int x, int y, int bmWidth, int bmHeight, const uchar *bitmap)
+{
+    blit(x, y, bmWidth, bmHeight, bitmap, layout == RowsLsbFirst);
+}
+
+// Draws a bitmap of packed rows (in lsbFirst or MSB-first bit order, in the depth of the display)
+// into the framebuffer at any pixel position, clipped to the display.
+void Glcd::blit(int x, int y, int bmWidth, int bmHeight, const uchar *bitmap, bool lsbFirst)
+{
+    int bmBytes = bmWidth*depth/8;
+    int srcX = 0;
+    if (x < 0)
     {
-        int first = (int)font[0];
-        int last = (int)font[1];
-        int size = last-first+1;
-        for (int i = 2; i < size+2; i++)
+        srcX = -x;
+        bmWidth += x;
+        x = 0;
+    }
+    if (y < 0)
+    {
+        bitmap += -y*bmBytes;
+        bmHeight += y;
+        y = 0;
+    }
+    bmWidth = qMin(bmWidth, width-x);
+    bmHeight = qMin(bmHeight, height-y);
+    if (bmWidth <= 0 || bmHeight <= 0)
+        return;
+
+    markDirty(QRect(x, y, bmWidth, bmHeight));
+    cost.blits++;
+
+    if (layout == VerticalPages)
+    {
+        cost.ramBytes += bmWidth*bmHeight;
+        cost.chunks += (bmWidth*bmHeight+31)/32;
+        for (int row = 0; row < bmHeight; row++, y++, bitmap += bmBytes)
         {
-            delete [] font[i];
+            uchar *page = mem + (y/8)*stride + x;
+            uchar bitMask = 1 << (y%8);
+            for (int col = 0; col < bmWidth; col++)
+            {
+                int srcCol = srcX+col;
+                bool set = bitmap[srcCol/8] & (lsbFirst ? 1 << (srcCol%8) : 0x80 >> (srcCol%8));
+                if (set && blitMode == Xor)
+                {
+                    page[col] ^= bitMask;
+                }
+                else if (set)
+                {
+                    page[col] |= bitMask;
+                }
+                else if (blitMode == Copy)
+                {
+                    page[col] &= ~bitMask;
+                }
+            }
+        }
+        return;
+    }
+
+    // gray rows are blitted as rows of depth bits per pixel
+    x *= depth;
+    srcX *= depth;
+    bmWidth *= depth;
+    bool memLsbFirst = layout == RowsLsbFirst;
+    uchar *dst = mem + y*stride;
+    cost.ramBytes += ((x%8)+bmWidth+7)/8*bmHeight;
+
+    // byte aligned copies of the same bit order are plain row copies
+    if (blitMode == Copy && x%8 == 0 && srcX%8 == 0 && lsbFirst == memLsbFirst)
+    {
+        int bytes = bmWidth/8;
+        int rest = bmWidth%8;
+        const uchar *src = bitmap + srcX/8;
+        dst += x/8;
+        for (int i = 0; i < bmHeight; i++, dst += stride, src += bmBytes)
+        {
+            memcpy(dst, src, bytes);
+            if (rest)
+            {
+                writeChunk(dst, bytes*8, readChunk(src, bytes*8, rest, lsbFirst), rest, memLsbFirst, Copy);
+            }
+        }
+        return;
+    }
+
+    // otherwise rows are shifted into place 32 pixels at a time
+    cost.chunks += (bmWidth+31)/32*bmHeight;
+    for (int i = 0; i < bmHeight; i++, dst += stride, bitmap += bmBytes)
+    {
+        for (int done = 0; done < bmWidth; done += 32)
+        {
+            int n = qMin(32, bmWidth-done);
+            quint32 bits = readChunk(bitmap, srcX+done, n, lsbFirst);
+            if (lsbFirst != memLsbFirst)
+            {
+                bits = reversePixels(bits, depth);
+            }
+            writeChunk(dst, x+done, bits, n, memLsbFirst, blitMode);
         }
-        delete [] font;
     }
-    font = newFont;
 }
 
-void Glcd::drawBitmap(int x, int y, int bmWidth, int bmHeight, uchar *bitmap)
+// Bitmaps with bit 0 of the width header set are run-length encoded, like on the MCU
+// they are decoded into a row buffer before they are copied. Bitmaps of another depth
+// than the display are scaled to its gray levels first.
+void Glcd::drawEncoded(int x, int y, int bmWidth, int bmHeight, const uchar *bitmap, bool lsbFirst,
+                       int bmDepth, bool encoded, int srcSize)
 {
-    int maxBmHeight = height-y;
-    if (bmHeight > maxBmHeight)
+    QByteArray decoded;
+    if (encoded)
+    {
+        decoded = QByteArray(bmWidth*bmDepth/8*bmHeight, 0);
+        int srcRead;
+        cost.rleBytes += Rle::decode(bitmap, srcSize, (uchar*)decoded.data(), decoded.size(), &srcRead);
+        cost.flashBytes += srcRead;
+        bitmap = (const uchar*)decoded.constData();
+    }
+    else
     {
-        bmHeight = maxBmHeight;
+        cost.flashBytes += bmWidth*bmDepth/8*bmHeight;
     }
-    if (bmHeight <= 0)
+
+    if (bmDepth != depth)
+    {
+        bool memLsbFirst = layout == RowsLsbFirst;
+        QByteArray converted = convertDepth(bitmap, bmWidth, bmHeight, bmDepth, lsbFirst, depth, memLsbFirst);
+        blit(x, y, bmWidth, bmHeight, (const uchar*)converted.constData(), memLsbFirst);
         return;
+    }
+    blit(x, y, bmWidth, bmHeight, bitmap, lsbFirst);
+}
+
+void Glcd::drawImage(int x, int y, const uchar *image)
+{
+    const uchar *imgHeader = image;
+    int imgWidth = imgHeader[0] & ~7;
+    int imgHeight = imgHeader[1];
+    const uchar *bitmap = image+2;
+    cost.images++;
+    cost.flashBytes += 2;
+    drawEncoded(x, y, imgWidth, imgHeight, bitmap, layout == RowsLsbFirst, headerDepth(imgHeader[0]),
+                imgHeader[0] & 1, INT_MAX);
+}
 
-    bmWidth /= 8;
-    int memX = x/8;
-    int bmWidthCpy = bmWidth;
-    int maxBmWidth = (memWidth-memX);
-    if (bmWidthCpy > maxBmWidth)
+// Number of entries a binary search over count entries visits.
+static int searchSteps(int count)
+{
+    int steps = 0;
+    while (count > 0)
     {
-        bmWidthCpy = maxBmWidth;
+        count /= 2;
+        steps++;
     }
-    if (bmWidthCpy <= 0)
-        return;
+    return steps;
+}
 
-    int i;
-    for (i = 0; i < bmHeight; i++, y++)
+// Looks up a code point in a sparse table font: the glyph count, then code,glyph pairs sorted by code.
+// Returns the index of the pair, or -1.
+int Glcd::findSparseGlyph(uint code)
+{
+    int lo = 0;
+    int hi = font.count();
+    while (lo < hi)
     {
-        memcpy(mem[y]+memX, bitmap, bmWidthCpy);
-        bitmap += bmWidth;
+        int mid = (lo+hi)/2;
+        cost.lookups++;
+        cost.flashBytes += sizeof(uint);
+        if (font.code(mid) < code)
+        {
+            lo = mid+1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    if (lo < font.count() && font.code(lo) == code)
+    {
+        return lo;
     }
+    return -1;
 }
 
-void Glcd::drawImage(int x, int y, uchar *image)
+// Slot of the table font glyph drawn for a code point, without the header entries.
+// Missing glyphs in the range draw the first one, out of range is -1.
+int Glcd::glyphSlot(uint code)
 {
-    uchar *imgHeader = image;
-    int imgWidth = imgHeader[0];
-    int imgHeight = imgHeader[1];
-    uchar *bitmap = image+2;
-    drawBitmap(x, y, imgWidth, imgHeight, bitmap);
+    if (font.isNull())
+        return -1;
+
+    if (font.isSparse())
+    {
+        int slot = findSparseGlyph(code);
+        if (slot < 0 && font.count())
+        {
+            slot = 0;
+        }
+        return slot;
+    }
+
+    uint first = font.first();
+    uint last = font.last();
+    if (code < first || code > last)
+    {
+        qDebug() << "ch" << code << "first" << first << "last" << last;
+        return -1;
+    }
+    return font.glyph(code-first) ? code-first : 0;
 }
 
-int Glcd::drawChar(int x, int y, uchar ch)
+// Binary search in the kerning pairs: count, then first, second (u16) and amount (s8) per pair.
+int Glcd::kerningAmount(uint first, uint second)
 {
-    if (!font)
+    if (kerning.size() < 2 || first > 0xFFFF || second > 0xFFFF)
         return 0;
 
-    int first = (int)font[0];
-    int last = (int)font[1];
-    if (ch < first || ch > last)
+    const uchar *pairs = (const uchar*)kerning.constData();
+    quint32 key = first << 16 | second;
+    int lo = 0;
+    int hi = qMin(pairs[0] | pairs[1] << 8, (kerning.size()-2)/5);
+    while (lo < hi)
     {
-        qDebug() << "ch" << (int)ch << "first" << first << "last" << last;
-        return 0;
+        int mid = (lo+hi)/2;
+        const uchar *pair = pairs + 2 + mid*5;
+        quint32 pairKey = (quint32)(pair[0] | pair[1] << 8) << 16 | pair[2] | pair[3] << 8;
+        cost.lookups++;
+        cost.flashBytes += 5;
+        if (pairKey < key)
+        {
+            lo = mid+1;
+        }
+        else if (pairKey > key)
+        {
+            hi = mid;
+        }
+        else
+        {
+            return (signed char)pair[4];
+        }
     }
-    ch -= (first-2);
-    uchar *chHeader = font[ch];
-    if (!chHeader)
+    return 0;
+}
+
+int Glcd::drawChar(int x, int y, uint code)
+{
+    if (fontBlob)
     {
-        ch = 2;
-        chHeader = font[ch];
-        if (!chHeader)
+        // like the table font: out of range draws nothing, a missing glyph draws the first one
+        BitmapBlob::Glyph glyph;
+        bool sparse = fontBlob->flags() & BitmapBlob::Sparse;
+        if (!sparse && ((int)code < fontBlob->first() || (int)code >= fontBlob->first()+fontBlob->count()))
         {
             return 0;
         }
+        if (!fontBlob->glyph(code, &glyph) && !fontBlob->glyph(fontBlob->first(), &glyph))
+        {
+            return 0;
+        }
+        int steps = sparse ? searchSteps(fontBlob->count()) : 1;
+        cost.glyphs++;
+        cost.lookups += steps;
+        cost.flashBytes += steps*(sparse ? 8 : 4) + 8;     // table entries and the record header
+        drawEncoded(x, y+glyph.yoffset, glyph.width, glyph.height, glyph.bitmap,
+                    fontBlob->flags() & BitmapBlob::LsbFirst, fontBlob->depth(),
+                    glyph.flags & BitmapBlob::RleEncoded, glyph.available);
+        return glyph.width;
     }
 
-    int chWidth = chHeader[0];
+    return drawSlot(x, y, glyphSlot(code));
+}
+
+int Glcd::drawSlot(int x, int y, int slot)
+{
+    const uchar *chHeader = font.glyph(slot);
+    if (!chHeader)
+    {
+        return 0;
+    }
+    // the glyph pointer and the header
+    cost.glyphs++;
+    cost.lookups++;
+    cost.flashBytes += sizeof(uint)+4;
+
+    int chWidth = chHeader[0] & ~7;
     int chHeight = chHeader[1];
     int yoffset = chHeader[3];
-    uchar *chBitmap = font[ch]+4;
-    drawBitmap(x, y+yoffset, chWidth, chHeight, chBitmap);
+    const uchar *chBitmap = chHeader+4;
+    drawEncoded(x, y+yoffset, chWidth, chHeight, chBitmap, layout == RowsLsbFirst, headerDepth(chHeader[0]),
+                chHeader[0] & 1, INT_MAX);
     return chWidth;
 }
 
+// Decodes the UTF-8 sequence at str and advances str past it.
+// Bytes that do not start a valid sequence are taken as Latin-1.
+static uint nextCodePoint(const uchar *&str)
+{
+    uint lead = *str++;
+    int extra;
+    uint code;
+    if (lead < 0x80)
+    {
+        return lead;
+    }
+    else if ((lead & 0xE0) == 0xC0)
+    {
+        extra = 1;
+        code = lead & 0x1F;
+    }
+    else if ((lead & 0xF0) == 0xE0)
+    {
+        extra = 2;
+        code = lead & 0x0F;
+    }
+    else if ((lead & 0xF8) == 0xF0)
+    {
+        extra = 3;
+        code = lead & 0x07;
+    }
+    else
+    {
+        return lead;
+    }
+
+    for (int i = 0; i < extra; i++)
+    {
+        if ((str[i] & 0xC0) != 0x80)
+        {
+            return lead;
+        }
+    }
+    for (int i = 0; i < extra; i++)
+    {
+        code = (code << 6) | (*str++ & 0x3F);
+    }
+    return code;
+}
+
 void Glcd::drawStr(int x, int y, const char *str)
 {
-    while (*str)
+    const uchar *p = (const uchar*)str;
+    uint prev = 0;
+    while (*p)
     {
-        char ch = *str;
-        int chWidth = drawChar(x, y, ch);
-        x += chWidth;
-        str++;
+        uint code = nextCodePoint(p);
+        if (metrics.isEmpty() || fontBlob)
+        {
+            x += drawChar(x, y, code);
+            continue;
+        }
+
+        // pen position advances by xadvance and kerning, bitmaps are placed relative to it
+        int slot = glyphSlot(code);
+        if (slot < 0 || 2*slot+1 >= metrics.size())
+        {
+            continue;
+        }
+        if (prev)
+        {
+            x += kerningAmount(prev, code);
+        }
+        cost.flashBytes += 2;
+        drawSlot(x + (signed char)metrics.at(2*slot), y, slot);
+        x += (uchar)metrics.at(2*slot+1);
+        prev = code;
     }
 }
 
@@ -212,15 +671,27 @@ void Glcd::drawPixel(int x, int y, bool color)
         return;
     }
 
-    int xByte = x/8;
-    int bitMask = 1<<(7-(x%8));
+    markDirty(QRect(x, y, 1, 1));
+    uchar *p;
+    uchar bitMask;
+    if (layout == VerticalPages)
+    {
+        p = mem + (y/8)*stride + x;
+        bitMask = 1 << (y%8);
+    }
+    else
+    {
+        // a set gray pixel has the highest level
+        p = mem + y*stride + x*depth/8;
+        bitMask = ((1 << depth)-1) << pixelShift(x, depth, layout == RowsLsbFirst);
+    }
     if (color)
     {
-        mem[y][xByte] |= bitMask;
+        *p |= bitMask;
     }
     else
     {
-        mem[y][xByte] &= ~bitMask;
+        *p &= ~bitMask;
     }
 }
 
@@ -2,47 +2,98 @@
 #define GLCD_H
 
 #include <QImage>
-#include <QPixmap>
-#include <QPainter>
 #include <QRect>
 #include <QPoint>
+#include "mcuprofile.h"
+#include "fontdata.h"
+
+class BitmapBlob;
 
 class Glcd
 {
 public:
-    Glcd(int width, int height, int pixelWidth, int pixelHeight, int spaceWidth, int spaceHeight);
+    // Framebuffer byte layouts of common controllers:
+    // RowsMsbFirst/RowsLsbFirst - one byte holds 8 horizontal pixels, leftmost in bit 7 or bit 0
+    // VerticalPages - SSD1306/ST7565 style, one byte holds 8 vertical pixels of a page, topmost in bit 0
+    // Gray2Rows/Gray4Rows - SSD1322/SSD1327 style gray levels, one byte holds 4 or 2 horizontal pixels,
+    // leftmost in the high bits
+    enum Layout{
+        RowsMsbFirst = 0, RowsLsbFirst, VerticalPages, Gray2Rows, Gray4Rows
+    };
+
+    // How drawn bitmaps combine with the framebuffer: Copy also clears the unset pixels.
+    enum BlitMode{
+        Copy = 0, Or, Xor
+    };
+
+    // stride is the number of bytes per row (or per page), 0 for the smallest that fits the width
+    Glcd(int width, int height, int pixelWidth, int pixelHeight, int spaceWidth, int spaceHeight,
+         Layout layout = RowsMsbFirst, int stride = 0);
     ~Glcd();
     void setPixelSize(int pixWidth, int pixHeight);
     void setSpaceSize(int sWidth, int sHeight);
 
     QSize size() { return QSize(width, height); }
-    QPixmap getPixmap() { return QPixmap::fromImage(*image); }
+    const QImage &getImage() { return *image; }
     QSize pixmapSize() { return image->size(); }
+    Layout getLayout() { return layout; }
+    int getDepth() { return depth; }    // bits per pixel
+    int getStride() { return stride; }
+    const uchar *getMem() { return mem; }
+    // bit order of the bitmaps drawBitmap() expects, also used for table fonts
+    QImage::Format bitmapFormat() { return layout == RowsLsbFirst ? QImage::Format_MonoLSB : QImage::Format_Mono; }
 
-    void setFont(uchar **newFont);
-    void drawBitmap(int x, int y, int bmWidth, int bmHeight, uchar *bitmap);
-    void drawImage(int x, int y, uchar *image);
-    int drawChar(int x, int y, uchar ch);
-    void drawStr(int x, int y, const char *str);
+    void setBlitMode(BlitMode mode) { blitMode = mode; }
+    // what the draw calls since the last resetCost() would have cost on the device
+    const RenderCost &getCost() { return cost; }
+    void resetCost() { cost = RenderCost(); }
+    void setFont(const FontData &newFont);  // see Converter::getFontData()
+    void setFont(BitmapBlob *newFont);  // takes ownership, glyphs are read from the mapped blob
+    // Proportional text for table fonts, see Converter::getMetricsData() and getKerningData().
+    // Without metrics drawStr() advances by the bitmap widths. setFont() clears them.
+    void setMetrics(const QByteArray &metrics, const QByteArray &kerning);
+    // bitmap in the bit order and depth of the display
+    void drawBitmap(int x, int y, int bmWidth, int bmHeight, const uchar *bitmap);
+    void drawImage(int x, int y, const uchar *image);     // see Converter::getImageData()
+    int drawChar(int x, int y, uint code);
+    void drawStr(int x, int y, const char *str);    // UTF-8
     void drawPixel(int x, int y, bool color);
     void drawLine(int x0, int y0, int x1, int y1, bool color);
     void fillMem(uchar data);
-    void renderMem();
+    // Renders the display pixels changed since the last call into the image,
+    // returns the image area that changed (empty if nothing did).
+    QRect renderMem();
     void printMem();
 
     QPoint translatePos(QPoint pos);
 
 private:
     void createImage();
-    void renderPixel(int x, int y, bool color);
+    void markDirty(const QRect &rect);
+    int memPixel(int x, int y) const;
+    int findSparseGlyph(uint code);
+    int glyphSlot(uint code);
+    int drawSlot(int x, int y, int slot);
+    int kerningAmount(uint first, uint second);
+    void blit(int x, int y, int bmWidth, int bmHeight, const uchar *bitmap, bool lsbFirst);
+    void drawEncoded(int x, int y, int bmWidth, int bmHeight, const uchar *bitmap, bool lsbFirst,
+                     int bmDepth, bool encoded, int srcSize);
 
     QImage *image;
-    QPainter *painter;
-    int width, height, memWidth;
+    BlitMode blitMode;
+    RenderCost cost;
+    QRect dirty;    // display pixels changed since the last renderMem()
+    int width, height;
+    Layout layout;
+    int depth;
+    int stride, memSize;
     int pixelWidth, pixelHeight;
     int spaceWidth, spaceHeight;
-    uchar **mem;
-    uchar **font;
+    uchar *mem;     // one block of memSize bytes, stride bytes per row or page
+    FontData font;
+    QByteArray metrics;
+    QByteArray kerning;
+    BitmapBlob *fontBlob;
 };
 
 
@@ -1,12 +1,60 @@
 #include "glcdscene.h"
 #include "mainwindow.h"
 #include <QGraphicsSceneMouseEvent>
+#include <QStyleOptionGraphicsItem>
+#include <QPainter>
+
+
+GlcdItem::GlcdItem(Glcd *glcd):
+    glcd(glcd)
+{
+    size = glcd->pixmapSize();
+    // exposedRect is only filled in with this flag
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+}
+
+QRectF GlcdItem::boundingRect() const
+{
+    return QRectF(QPointF(0, 0), size);
+}
+
+void GlcdItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget)
+{
+    Q_UNUSED(widget);
+    const QImage &image = glcd->getImage();
+    QRect rect = option->exposedRect.toAlignedRect() & image.rect();
+    painter->drawImage(rect.topLeft(), image, rect);
+}
+
+void GlcdItem::sizeChanged()
+{
+    prepareGeometryChange();
+    size = glcd->pixmapSize();
+    update();
+}
 
 
 GlcdScene::GlcdScene(Glcd *glcd, QObject* parent):
     glcd(glcd), QGraphicsScene(parent)
 {
     mainWin = qobject_cast<MainWindow*>(parent);
+    item = new GlcdItem(glcd);
+    addItem(item);
+    setSceneRect(item->boundingRect());
+}
+
+void GlcdScene::updateGlcd(const QRect &rect)
+{
+    if (!rect.isEmpty())
+    {
+        item->update(rect);
+    }
+}
+
+void GlcdScene::glcdResized()
+{
+    item->sizeChanged();
+    setSceneRect(item->boundingRect());
 }
 
 void GlcdScene::mouseMoveEvent(QGraphicsSceneMouseEvent* event)
@@ -14,4 +62,3 @@ void GlcdScene::mouseMoveEvent(QGraphicsSceneMouseEvent* event)
     QPoint pos = glcd->translatePos(event->scenePos().toPoint());
     mainWin->pixelHovered(pos);
 }
-
@@ -2,8 +2,24 @@
 #define GLCDSCENE_H
 
 #include <QGraphicsScene>
+#include <QGraphicsItem>
 #include "glcd.h"
 
+// Shows the glcd image in place, so a redraw only repaints the area that changed.
+class GlcdItem : public QGraphicsItem
+{
+public:
+    GlcdItem(Glcd *glcd);
+
+    QRectF boundingRect() const;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+    void sizeChanged();
+
+private:
+    Glcd *glcd;
+    QSize size;
+};
+
 class MainWindow;
 class GlcdScene : public QGraphicsScene
 {
@@ -11,12 +27,15 @@ class GlcdScene : public QGraphicsScene
 
 public:
     GlcdScene(Glcd *glcd, QObject* parent = 0);
+    void updateGlcd(const QRect &rect);     // image area returned by Glcd::renderMem()
+    void glcdResized();
 
 protected:
     void mouseMoveEvent(QGraphicsSceneMouseEvent *event);
 
 private:
     Glcd *glcd;
+    GlcdItem *item;
     MainWindow *mainWin;
 };
 
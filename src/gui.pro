@@ -0,0 +1,27 @@
+#-------------------------------------------------
+#
+# Project created by QtCreator 2013-10-12T21:08:58
+#
+#-------------------------------------------------
+
+QT       += core gui
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = fontConverter
+TEMPLATE = app
+
+include(converter.pri)
+
+SOURCES += main.cpp\
+        mainwindow.cpp \
+    glcd.cpp \
+    glcdscene.cpp \
+    mcuprofile.cpp
+
+HEADERS  += mainwindow.h \
+    glcd.h \
+    glcdscene.h \
+    mcuprofile.h
+
+FORMS    += mainwindow.ui
@@ -1,5 +1,6 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "bitmapblob.h"
 
 #include <QDebug>
 #include <QFileDialog>
@@ -7,6 +8,26 @@
 #include <QImage>
 #include <QPainter>
 #include <QMessageBox>
+#include <limits.h>
+
+
+static QPixmap thumbnail(const CharInfo *charInfo)
+{
+    return QPixmap::fromImage(Converter::bitmapToImage(charInfo->bitmap, charInfo->width, charInfo->height,
+                                                       charInfo->depth));
+}
+
+static QPixmap thumbnail(const ImageInfo *imgInfo)
+{
+    return QPixmap::fromImage(Converter::bitmapToImage(imgInfo->bitmap, imgInfo->width, imgInfo->height,
+                                                       imgInfo->depth));
+}
+
+static QString codePointText(int code)
+{
+    uint ucs4 = code;
+    return QString::fromUcs4(&ucs4, 1).toHtmlEscaped();
+}
 
 
 MainWindow::MainWindow(QWidget *parent) :
@@ -15,9 +36,27 @@ MainWindow::MainWindow(QWidget *parent) :
 {
     ui->setupUi(this);
     isFontFile = false;
-
     glcd = NULL;
     glcdScene = NULL;
+
+    glcdLayouts.append("Rows, MSB first");
+    glcdLayouts.append("Rows, LSB first");
+    glcdLayouts.append("Pages (SSD1306)");
+    glcdLayouts.append("Gray 2 bpp rows");
+    glcdLayouts.append("Gray 4 bpp rows (SSD1322)");
+    ui->glcdLayout->addItems(glcdLayouts);
+
+    blitModes.append("Copy");
+    blitModes.append("OR");
+    blitModes.append("XOR");
+    ui->blitMode->addItems(blitModes);
+
+    foreach (const McuProfile &profile, McuProfile::all())
+    {
+        mcuProfiles.append(profile.name);
+    }
+    ui->mcuProfile->addItems(mcuProfiles);
+
     createGlcdView();
     connect(ui->setGlcdSizeButton, SIGNAL(clicked(bool)), this, SLOT(createGlcdView()));
 
@@ -29,12 +68,28 @@ MainWindow::MainWindow(QWidget *parent) :
     bitorders.append("LSB first");
     ui->bitorder->addItems(bitorders);
 
-    presets.append("ESP8266");
-    presets.append("Generic (8 bit)");
-    presets.append("Generic (32 bit)");
+    depths.append("1 bpp");
+    depths.append("2 bpp gray");
+    depths.append("4 bpp gray");
+    ui->depth->addItems(depths);
+
+    ditherMethods.append("Threshold");
+    ditherMethods.append("Floyd-Steinberg");
+    ditherMethods.append("Atkinson");
+    ditherMethods.append("Bayer");
+    ui->dither->addItems(ditherMethods);
+
+    outputFormats.append("C source");
+    outputFormats.append("Binary blob");
+    ui->outputFormat->addItems(outputFormats);
+
+    foreach (const OutputPreset &preset, OutputPreset::all())
+    {
+        presets.append(preset.name);
+    }
     ui->preset->addItems(presets);
 
-    presetChanged(ESP8266);
+    presetChanged(OutputPreset::ESP8266);
     connect(ui->preset, SIGNAL(currentIndexChanged(int)), this, SLOT(presetChanged(int)));
 
     ui->generateButton->setEnabled(false);
@@ -44,6 +99,8 @@ MainWindow::MainWindow(QWidget *parent) :
     ui->lThreshold->setVisible(false);
     ui->threshold->setVisible(false);
 
+    connect(&sourceWatcher, SIGNAL(filesChanged(QStringList)), this, SLOT(sourceFilesChanged(QStringList)));
+
     ui->fill->setInputMask("\\0\\xHH");
     ui->fill->setText("0xFF");
 }
@@ -62,7 +119,9 @@ void MainWindow::createGlcdView()
     int pixelSize = ui->pixelSize->value();
     int spaceSize = ui->spaceSize->value();
     glcd = new Glcd(ui->glcdWidth->value(), ui->glcdHeight->value(),
-                    pixelSize, pixelSize, spaceSize, spaceSize);
+                    pixelSize, pixelSize, spaceSize, spaceSize,
+                    (Glcd::Layout)ui->glcdLayout->currentIndex());
+    glcd->setBlitMode((Glcd::BlitMode)ui->blitMode->currentIndex());
 
     glcdScene = new GlcdScene(glcd, this);
     ui->glcdView->setScene(glcdScene);
@@ -72,32 +131,19 @@ void MainWindow::createGlcdView()
     {
         setGlcdFont();
     }
+    else if (!blobFile.isEmpty())
+    {
+        openBlob(blobFile);
+    }
 }
 
 void MainWindow::presetChanged(int preset)
 {
-    if (preset == ESP8266)
-    {
-        ui->arraySyntax1->setText("static const unsigned int %1[%2] ICACHE_RODATA_ATTR={");
-        ui->arraySyntax2->setText("const unsigned int *%1[%2] ={");
-        ui->includes->clear();
-        ui->includes->appendPlainText("#include <ets_sys.h>\n");
-        ui->bitcount->setCurrentIndex(bits32);
-    }
-    else if (preset == Generic_8bit)
-    {
-        ui->arraySyntax1->setText("static const unsigned char %1[%2] ={");
-        ui->arraySyntax2->setText("const unsigned char *%1[%2] ={");
-        ui->includes->clear();
-        ui->bitcount->setCurrentIndex(bits8);
-    }
-    else if (preset == Generic_32bit)
-    {
-        ui->arraySyntax1->setText("static const unsigned int %1[%2] ={");
-        ui->arraySyntax2->setText("const unsigned int *%1[%2] ={");
-        ui->includes->clear();
-        ui->bitcount->setCurrentIndex(bits32);
-    }
+    OutputPreset p = OutputPreset::get(preset);
+    ui->arraySyntax1->setText(p.arraySyntax1);
+    ui->arraySyntax2->setText(p.arraySyntax2);
+    ui->includes->setPlainText(p.includes);
+    ui->bitcount->setCurrentIndex(p.bitcount32 ? bits32 : bits8);
 }
 
 const CharInfo *MainWindow::getCurrentCharInfo()
@@ -130,6 +176,19 @@ bool MainWindow::openFont(const QString &filename)
     return true;
 }
 
+// Previews a binary font: the glcd draws straight from the mapped file.
+bool MainWindow::openBlob(const QString &filename)
+{
+    BitmapBlob *blob = new BitmapBlob;
+    if (!blob->open(filename) || blob->type() != BitmapBlob::Font)
+    {
+        delete blob;
+        return false;
+    }
+    glcd->setFont(blob);
+    return true;
+}
+
 
 void MainWindow::initPreview()
 {
@@ -139,14 +198,22 @@ void MainWindow::initPreview()
     {
         foreach (CharInfo *ch, converter.getChars())
         {
-            ui->listWidget->addItem( new QListWidgetItem( QIcon(ch->charPic), QString() ));
+            ui->listWidget->addItem( new QListWidgetItem( QIcon(thumbnail(ch)), QString() ));
         }
+        // glyphs excluded before a reload keep their disabled icons
+        QList<int> rows;
+        for (int i = 0; i < converter.getChars().size(); i++)
+        {
+            if (converter.getChars().at(i)->skip)
+                rows.append(i);
+        }
+        updateCharIcons(rows);
     }
     else
     {
         foreach (ImageInfo *img, converter.getImages())
         {
-            ui->listWidget->addItem( new QListWidgetItem( QIcon(img->pixmap), QString() ));
+            ui->listWidget->addItem( new QListWidgetItem( QIcon(thumbnail(img)), QString() ));
         }
     }
 }
@@ -158,10 +225,32 @@ void MainWindow::updateFontInfoLabels(const FontInfo *fontInfo)
 
     ui->lFontName->setText( "<b>" + fontInfo->name );
     ui->lFontSize->setText( "<b>" + QString().sprintf("%d * %d%", fontInfo->size, fontInfo->stretch) );
-    ui->lFontFirst->setText( "<b>" + QString().sprintf("(0x%02x) '%c'", fontInfo->first, fontInfo->first) );
-    ui->lFontLast->setText( "<b>" + QString().sprintf("(0x%02x) '%c'", fontInfo->last, fontInfo->last) );
+    ui->lFontFirst->setText( "<b>" + QString().sprintf("(0x%02x) '", fontInfo->first) + codePointText(fontInfo->first) + "'" );
+    ui->lFontLast->setText( "<b>" + QString().sprintf("(0x%02x) '", fontInfo->last) + codePointText(fontInfo->last) + "'" );
     ui->lFontUsed->setText( "<b>" + QString().sprintf("%d / %d", fontInfo->used, fontInfo->count) );
-    ui->lFontBytes->setText( "<b>" + QString().sprintf("%d B", fontInfo->overallSize) );
+    updateFontBytesLabel();
+}
+
+void MainWindow::updateFontBytesLabel()
+{
+    int overallSize = converter.getFontInfo()->overallSize;
+    int sharedBytes = converter.getSharedBytes();
+    int trimmedBytes = converter.getFontInfo()->trimmedBytes;
+    QStringList savings;
+    if (sharedBytes)
+    {
+        savings.append(QString().sprintf("%d B shared", sharedBytes));
+    }
+    if (trimmedBytes)
+    {
+        savings.append(QString().sprintf("%d B trimmed", trimmedBytes));
+    }
+    QString text = QString().sprintf("%d B", overallSize-sharedBytes);
+    if (!savings.isEmpty())
+    {
+        text += " (" + savings.join(", ") + ")";
+    }
+    ui->lFontBytes->setText( "<b>" + text );
 }
 
 void MainWindow::updateCharInfoLabels(const CharInfo *charInfo)
@@ -170,10 +259,10 @@ void MainWindow::updateCharInfoLabels(const CharInfo *charInfo)
         return;
 
     ui->lCharIndex->setText( "<b>" + QString::number(ui->listWidget->currentIndex().row()) );
-    ui->lCharChar->setText( "<b>" + QString().sprintf("'%c' %d (0x%02x)", charInfo->id, charInfo->id, charInfo->id) );
+    ui->lCharChar->setText( "<b>'" + codePointText(charInfo->id) + QString().sprintf("' %d (0x%02x)", charInfo->id, charInfo->id) );
     ui->lCharDim->setText( "<b>" + QString().sprintf("%d x %d", charInfo->width, charInfo->height) );
     ui->lCharScaled->setText( charInfo->scaled ? "<b>Yes" : "<b>No" );
-    ui->lCharBytes->setText( "<b>" + QString().sprintf("%d B", charInfo->byteSize ) );
+    ui->lCharBytes->setText( "<b>" + QString().sprintf("%d B (RLE %d B)", charInfo->byteSize, charInfo->rleSize ) );
     ui->charIncluded->setChecked(!charInfo->skip);
     ui->charCustomWidth->setValue(charInfo->customWidth);
     ui->charCustomWidth->setEnabled(charInfo->useCustomWidth && !charInfo->skip);
@@ -189,7 +278,7 @@ void MainWindow::updateImgInfoLabels(const ImageInfo *imgInfo)
     ui->lImgName->setText("<b>" + imgInfo->name);
     ui->lImgDim->setText("<b>" + QString().sprintf("%d x %d", imgInfo->width, imgInfo->height));
     ui->lImgScaled->setText(imgInfo->scaled ? "<b>Yes" : "<b>No");
-    ui->lImgBytes->setText("<b>" + QString().sprintf("%d B", imgInfo->byteSize ));
+    ui->lImgBytes->setText("<b>" + QString().sprintf("%d B (RLE %d B)", imgInfo->byteSize, imgInfo->rleSize ));
     ui->imgCustomWidth->setValue(imgInfo->customWidth);
     ui->imgCustomWidth->setEnabled(imgInfo->useCustomWidth);
     ui->imgCustomWidthEnb->setChecked(imgInfo->useCustomWidth);
@@ -225,7 +314,7 @@ void MainWindow::on_openFileButton_clicked()
     QStringList filenames = QFileDialog::getOpenFileNames(
                 this,
                 "Select file to open",
-                QFileInfo(fontFile).absolutePath(), "(*.fnt *.png *.bmp *.jpg)");
+                QFileInfo(fontFile).absolutePath(), "(*.fnt *.png *.bmp *.jpg *.bin)");
 
     if (filenames.isEmpty())
         return;
@@ -242,7 +331,36 @@ void MainWindow::on_openFileButton_clicked()
         }
     }
 
+    if (suffix == "bin")
+    {
+        if (filenames.size() != 1 || !openBlob(filenames.first()))
+        {
+            QMessageBox msgBox;
+            msgBox.setText("Open a single binary font file.");
+            msgBox.exec();
+            return;
+        }
+        fontFile = filenames.first();
+        blobFile = fontFile;
+        isFontFile = false;
+        converter.clearChars();
+        converter.clearImages();
+        ui->listWidget->clear();
+        setWindowTitle("FontConverter - " + QDir::toNativeSeparators(blobFile));
+        ui->generateButton->setEnabled(false);
+        ui->fontInfoBox->setVisible(false);
+        ui->charInfoBox->setVisible(false);
+        ui->imgInfoBox->setVisible(false);
+        ui->lThreshold->setVisible(false);
+        ui->threshold->setVisible(false);
+        outputFile.clear();
+        updateWatchedFiles();
+        return;
+    }
+
     fontFile = filenames.first();
+    blobFile.clear();
+    outputFile.clear();
     isFontFile = suffix == "fnt";
     if (isFontFile)
     {
@@ -275,6 +393,7 @@ void MainWindow::on_openFileButton_clicked()
     ui->imgInfoBox->setVisible(!isFontFile);
     ui->lThreshold->setVisible(true);
     ui->threshold->setVisible(true);
+    updateWatchedFiles();
 }
 
 
@@ -293,16 +412,38 @@ void MainWindow::on_generateButton_clicked()
             return;
         abspath = QFileInfo(imgInfo->srcFile).absolutePath();
     }
+    bool binary = ui->outputFormat->currentIndex() == BinaryBlob;
+    QString extension = binary ? "bin" : "c";
     QString filename = QFileDialog::getSaveFileName(this, "Save File",
-                               abspath+"/"+basename+".c", ("(*.c)"));
+                               abspath+"/"+basename+"."+extension, "(*."+extension+")");
     if (filename.isNull())
         return;
 
+    outputFile = filename;
+    generate(filename);
+}
+
+// Writes the open font or images to filename with the current output settings.
+void MainWindow::generate(const QString &filename)
+{
+    QString basename = isFontFile ? QFileInfo(fontFile).baseName() : "images";
+    bool binary = ui->outputFormat->currentIndex() == BinaryBlob;
     QString includes = ui->includes->toPlainText();
     bool bitcount32 = ui->bitcount->currentIndex() == bits32;
     QImage::Format format = ui->bitorder->currentIndex() == MSB_first ?
                             QImage::Format_Mono : QImage::Format_MonoLSB;
-    if (isFontFile)
+    if (binary)
+    {
+        if (isFontFile)
+        {
+            converter.generateFontBlob(filename, bitcount32, format);
+        }
+        else
+        {
+            converter.generateImagesBlob(filename, bitcount32, format);
+        }
+    }
+    else if (isFontFile)
     {
         converter.generateFont(filename, basename,
                                includes, bitcount32, format,
@@ -317,9 +458,67 @@ void MainWindow::on_generateButton_clicked()
     }
 }
 
+//------------------------------------------------------------------------------------
+// Watch mode: the open font or images are converted again when their files change,
+// and written again to the file generated last.
+void MainWindow::on_watch_clicked(bool checked)
+{
+    Q_UNUSED(checked);
+    updateWatchedFiles();
+}
+
+void MainWindow::updateWatchedFiles()
+{
+    QStringList files;
+    if (ui->watch->isChecked())
+    {
+        files = isFontFile ? converter.getFontFiles() : converter.getImgFiles();
+    }
+    sourceWatcher.setFiles(files);
+}
+
+void MainWindow::sourceFilesChanged(const QStringList &files)
+{
+    QModelIndex index = ui->listWidget->currentIndex();
+    bool ok;
+    if (isFontFile)
+    {
+        bool reopened = files.contains(converter.getFontFiles().value(0));
+        QList<int> rows = converter.reloadFontFiles(files, &ok);
+        if (reopened)
+        {
+            initPreview();
+            clearCharInfoLabels();
+            ui->listWidget->setCurrentIndex(index);
+        }
+        else
+        {
+            updateCharIcons(rows);
+        }
+        updateFontInfoLabels(converter.getFontInfo());
+        setGlcdFont();
+        updateWatchedFiles();
+    }
+    else
+    {
+        updateImgIcons(converter.reloadImages(files, ui->threshold->value(), &ok));
+    }
+    drawItemOnGlcd(index.row());
+
+    // a file that is still being written comes again with its next change
+    if (ok && !outputFile.isEmpty())
+    {
+        generate(outputFile);
+    }
+}
+
 void MainWindow::setGlcdFont()
 {
-    glcd->setFont(converter.getFontData(QImage::Format_Mono));
+    glcd->setFont(converter.getFontData(glcd->bitmapFormat()));
+    if (converter.hasKerning())
+    {
+        glcd->setMetrics(converter.getMetricsData(), converter.getKerningData());
+    }
 }
 
 
@@ -344,9 +543,11 @@ void MainWindow::drawItemOnGlcd(int index)
         updateCharInfoLabels(charInfo);
 
         glcd->fillMem(0);
-        glcd->drawChar(ui->cursorX->value(), ui->cursorY->value(), (char)charInfo->id);
+        glcd->resetCost();
+        glcd->drawChar(ui->cursorX->value(), ui->cursorY->value(), charInfo->id);
         //glcd->printMem();
         drawGlcd();
+        updateRenderInfo();
     }
     else
     {
@@ -356,33 +557,120 @@ void MainWindow::drawItemOnGlcd(int index)
 
         updateImgInfoLabels(imgInfo);
 
-        uchar *image = converter.getImageData(index, QImage::Format_Mono);
+        QByteArray image = converter.getImageData(index, glcd->bitmapFormat());
         glcd->fillMem(0);
-        glcd->drawImage(ui->cursorX->value(), ui->cursorY->value(), image);
+        glcd->resetCost();
+        glcd->drawImage(ui->cursorX->value(), ui->cursorY->value(), (const uchar*)image.constData());
         drawGlcd();
-        delete image;
+        updateRenderInfo();
     }
 }
 
 void MainWindow::on_threshold_valueChanged(int arg1)
 {
-    arg1;
     QModelIndex index = ui->listWidget->currentIndex();
     if (isFontFile)
     {
-        openFont(fontFile);
+        // only the glyphs whose width changes are re-rasterized, and only their icons replaced
+        updateCharIcons(converter.setThreshold(arg1));
+        updateFontInfoLabels(converter.getFontInfo());
+        setGlcdFont();
+        drawItemOnGlcd(index.row());
+        return;
     }
-    else
+
+    reconvertImages();
+}
+
+// Converts the open images again with the current settings, from their decoded sources.
+void MainWindow::reconvertImages()
+{
+    QModelIndex index = ui->listWidget->currentIndex();
+    QList<int> rows;
+    for (int i = 0; i < converter.getImages().size(); i++)
     {
-        QStringList filenames = converter.getImgFiles();
-        converter.clearImages();
-        foreach (QString filename, filenames)
+        converter.recreateImgPic(converter.getImages().at(i), ui->threshold->value());
+        rows.append(i);
+    }
+    updateImgIcons(rows);
+    drawItemOnGlcd(index.row());
+}
+
+void MainWindow::updateCharIcons(const QList<int> &rows)
+{
+    foreach (int row, rows)
+    {
+        const CharInfo *charInfo = converter.getCharInfo(row);
+        QListWidgetItem *item = ui->listWidget->item(row);
+        if (!charInfo || !item)
+            continue;
+        QPixmap pixmap = thumbnail(charInfo);
+        if (charInfo->skip)
         {
-            converter.openImage(filename, ui->threshold->value());
+            pixmap = QIcon(pixmap).pixmap(ui->listWidget->iconSize(), QIcon::Disabled);
         }
-        initPreview();
+        item->setIcon(pixmap);
+    }
+}
+
+void MainWindow::updateImgIcons(const QList<int> &rows)
+{
+    foreach (int row, rows)
+    {
+        const ImageInfo *imgInfo = converter.getImageInfo(row);
+        QListWidgetItem *item = ui->listWidget->item(row);
+        if (imgInfo && item)
+        {
+            item->setIcon(thumbnail(imgInfo));
+        }
+    }
+}
+
+// Applies the first/last char spinboxes, the list widget only gets entries added or dropped.
+void MainWindow::setCharRange()
+{
+    QList<CharInfo*> oldChars = converter.getChars();
+    converter.setCharRange(ui->firstChar->value(), ui->lastChar->value());
+    const QList<CharInfo*> &chars = converter.getChars();
+    int first = ui->firstChar->value();
+    int last = ui->lastChar->value();
+
+    // both lists are sorted by id, so entries only change at the ends
+    int dropFront = 0;
+    while (dropFront < oldChars.size() && oldChars.at(dropFront)->id < first)
+        dropFront++;
+    int dropBack = 0;
+    while (dropBack < oldChars.size()-dropFront && oldChars.at(oldChars.size()-1-dropBack)->id > last)
+        dropBack++;
+    for (int i = 0; i < dropFront; i++)
+    {
+        delete ui->listWidget->takeItem(0);
+    }
+    for (int i = 0; i < dropBack; i++)
+    {
+        delete ui->listWidget->takeItem(ui->listWidget->count()-1);
     }
-    ui->listWidget->setCurrentIndex(index);
+
+    int kept = oldChars.size()-dropFront-dropBack;
+    int keptFirst = kept ? oldChars.at(dropFront)->id : INT_MAX;
+    int addFront = 0;
+    while (addFront < chars.size() && chars.at(addFront)->id < keptFirst)
+        addFront++;
+    if (!kept)
+    {
+        addFront = chars.size();
+    }
+    for (int i = addFront-1; i >= 0; i--)
+    {
+        ui->listWidget->insertItem(0, new QListWidgetItem( QIcon(thumbnail(chars.at(i))), QString() ));
+    }
+    for (int i = addFront+kept; i < chars.size(); i++)
+    {
+        ui->listWidget->addItem( new QListWidgetItem( QIcon(thumbnail(chars.at(i))), QString() ));
+    }
+
+    updateFontInfoLabels(converter.getFontInfo());
+    setGlcdFont();
 }
 
 void MainWindow::on_firstChar_valueChanged(int arg1)
@@ -390,7 +678,7 @@ void MainWindow::on_firstChar_valueChanged(int arg1)
     ui->lastChar->setMinimum(arg1);
     if (isFontFile)
     {
-        openFont(fontFile);
+        setCharRange();
     }
 }
 
@@ -399,7 +687,7 @@ void MainWindow::on_lastChar_valueChanged(int arg1)
     ui->firstChar->setMaximum(arg1);
     if (isFontFile)
     {
-        openFont(fontFile);
+        setCharRange();
     }
 }
 
@@ -414,8 +702,8 @@ void MainWindow::on_charCustomWidthEnb_clicked(bool checked)
     converter.recreateCharPic(charInfo, ui->threshold->value());
 
     updateCharInfoLabels(charInfo);
-    ui->lFontBytes->setText( "<b>" + QString().sprintf("%d B", converter.getFontInfo()->overallSize) );
-    ui->listWidget->currentItem()->setIcon(charInfo->charPic);
+    updateFontBytesLabel();
+    ui->listWidget->currentItem()->setIcon(thumbnail(charInfo));
     setGlcdFont();
 }
 
@@ -429,8 +717,8 @@ void MainWindow::on_charCustomWidth_valueChanged(int arg1)
     converter.recreateCharPic(charInfo, ui->threshold->value());
 
     updateCharInfoLabels(charInfo);
-    ui->lFontBytes->setText( "<b>" + QString().sprintf("%d B", converter.getFontInfo()->overallSize) );
-    ui->listWidget->currentItem()->setIcon(charInfo->charPic);
+    updateFontBytesLabel();
+    ui->listWidget->currentItem()->setIcon(thumbnail(charInfo));
     setGlcdFont();
 }
 
@@ -454,7 +742,7 @@ void MainWindow::on_charIncluded_clicked(bool checked)
     }
     else
     {
-        item->setIcon( charInfo->charPic );
+        item->setIcon( thumbnail(charInfo) );
 
         ui->charCustomWidthEnb->setEnabled(true);
         ui->charCustomWidth->setEnabled(charInfo->useCustomWidth);
@@ -475,7 +763,7 @@ void MainWindow::on_imgCustomWidthEnb_clicked(bool checked)
     converter.recreateImgPic(imgInfo, ui->threshold->value());
 
     updateImgInfoLabels(imgInfo);
-    ui->listWidget->currentItem()->setIcon(imgInfo->pixmap);
+    ui->listWidget->currentItem()->setIcon(thumbnail(imgInfo));
 }
 
 void MainWindow::on_imgCustomWidth_valueChanged(int arg1)
@@ -488,22 +776,80 @@ void MainWindow::on_imgCustomWidth_valueChanged(int arg1)
     converter.recreateImgPic(imgInfo, ui->threshold->value());
 
     updateImgInfoLabels(imgInfo);
-    ui->listWidget->currentItem()->setIcon(imgInfo->pixmap);
+    ui->listWidget->currentItem()->setIcon(thumbnail(imgInfo));
+}
+
+void MainWindow::on_rleCompression_clicked(bool checked)
+{
+    converter.setRleCompression(checked);
+    if (isFontFile && converter.getChars().size() > 0)
+    {
+        setGlcdFont();
+    }
+    drawItemOnGlcd(ui->listWidget->currentIndex().row());
+}
+
+void MainWindow::on_sparseTable_clicked(bool checked)
+{
+    converter.setSparse(checked);
+    if (isFontFile)
+    {
+        converter.setCharRange(ui->firstChar->value(), ui->lastChar->value());
+        initPreview();
+        clearCharInfoLabels();
+        updateFontInfoLabels(converter.getFontInfo());
+        setGlcdFont();
+    }
+}
+
+void MainWindow::on_kerning_clicked(bool checked)
+{
+    converter.setKerning(checked);
+    if (isFontFile)
+    {
+        setGlcdFont();
+    }
+}
+
+void MainWindow::on_packed_clicked(bool checked)
+{
+    converter.setPacked(checked);
+}
+
+void MainWindow::on_depth_currentIndexChanged(int index)
+{
+    converter.setDepth(1 << index);
+    if (isFontFile)
+    {
+        initPreview();
+        clearCharInfoLabels();
+        updateFontInfoLabels(converter.getFontInfo());
+        setGlcdFont();
+    }
+    else if (!converter.getImgFiles().isEmpty())
+    {
+        reconvertImages();
+    }
+}
+
+void MainWindow::on_dither_currentIndexChanged(int index)
+{
+    converter.setDither((Dither::Method)index);
+    if (!isFontFile && !converter.getImgFiles().isEmpty())
+    {
+        reconvertImages();
+    }
 }
 
 //------------------------------------------------------------------------------------
 void MainWindow::drawGlcd()
 {
-    glcd->renderMem();
-    updateGlcdView();
+    glcdScene->updateGlcd(glcd->renderMem());
 }
 
 void MainWindow::updateGlcdView()
 {
-    QPixmap pixmap = glcd->getPixmap();
-    glcdScene->clear();
-    glcdScene->addPixmap(pixmap);
-    glcdScene->setSceneRect(pixmap.rect());
+    glcdScene->glcdResized();
 }
 
 void MainWindow::on_pixelSize_valueChanged(int arg1)
@@ -518,11 +864,50 @@ void MainWindow::on_spaceSize_valueChanged(int arg1)
     updateGlcdView();
 }
 
+void MainWindow::on_blitMode_currentIndexChanged(int index)
+{
+    if (glcd)
+    {
+        glcd->setBlitMode((Glcd::BlitMode)index);
+    }
+}
+
 void MainWindow::on_printButton_clicked()
 {
+    glcd->resetCost();
     glcd->drawStr(ui->cursorX->value(), ui->cursorY->value(),
-                  ui->text->text().toLatin1().toStdString().c_str());
+                  ui->text->text().toUtf8().constData());
     drawGlcd();
+    updateRenderInfo();
+}
+
+void MainWindow::on_mcuProfile_currentIndexChanged(int index)
+{
+    Q_UNUSED(index);
+    updateRenderInfo();
+}
+
+// Estimated cost of the last print or item draw on the selected target.
+void MainWindow::updateRenderInfo()
+{
+    if (!glcd)
+        return;
+
+    const RenderCost &cost = glcd->getCost();
+    if (!cost.glyphs && !cost.images)
+    {
+        ui->renderInfo->setText("");
+        return;
+    }
+    McuProfile profile = McuProfile::get(ui->mcuProfile->currentIndex());
+    QString items = cost.images ? QString("%1 images").arg(cost.images) : QString("%1 glyphs").arg(cost.glyphs);
+    ui->renderInfo->setText(QString("%1: %2 B flash, %3 B written, %4 blits, ~%5 cycles = %6 us")
+                            .arg(items)
+                            .arg(cost.flashBytes)
+                            .arg(cost.ramBytes)
+                            .arg(cost.blits)
+                            .arg(qRound64(profile.cycles(cost)))
+                            .arg(profile.micros(cost), 0, 'f', 1));
 }
 
 void MainWindow::on_clearButton_clicked()
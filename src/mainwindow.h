@@ -2,13 +2,15 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
-#include <QDomDocument>
 #include <QModelIndex>
 #include <QListWidgetItem>
 #include <QStringList>
 #include "converter.h"
+#include "outputpreset.h"
+#include "mcuprofile.h"
 #include "glcdscene.h"
 #include "glcd.h"
+#include "sourcewatcher.h"
 
 namespace Ui {
 class MainWindow;
@@ -32,7 +34,9 @@ private slots:
     void on_listWidget_itemClicked(QListWidgetItem *item);
     void on_pixelSize_valueChanged(int arg1);
     void on_spaceSize_valueChanged(int arg1);
+    void on_blitMode_currentIndexChanged(int index);
     void on_printButton_clicked();
+    void on_mcuProfile_currentIndexChanged(int index);
     void on_clearButton_clicked();
     void on_fillButton_clicked();
     void on_threshold_valueChanged(int arg1);
@@ -43,25 +47,41 @@ private slots:
     void on_charIncluded_clicked(bool checked);
     void on_imgCustomWidthEnb_clicked(bool checked);
     void on_imgCustomWidth_valueChanged(int arg1);
+    void on_rleCompression_clicked(bool checked);
+    void on_sparseTable_clicked(bool checked);
+    void on_kerning_clicked(bool checked);
+    void on_packed_clicked(bool checked);
+    void on_depth_currentIndexChanged(int index);
+    void on_dither_currentIndexChanged(int index);
+    void on_watch_clicked(bool checked);
+    void sourceFilesChanged(const QStringList &files);
 
 
 private:
     Ui::MainWindow *ui;
 
-    enum Preset{
-        ESP8266 = 0, Generic_8bit, Generic_32bit
-    };
     enum Bitcount{
         bits8 = 0, bits32
     };
     enum Bitorder{
         MSB_first = 0, LSB_first
     };
-    QStringList presets, bitcounts, bitorders;
+    enum OutputFormat{
+        CSource = 0, BinaryBlob
+    };
+    QStringList presets, bitcounts, bitorders, depths, ditherMethods, outputFormats, glcdLayouts, blitModes, mcuProfiles;
 
     bool openFont(const QString &filename);
+    void setCharRange();
+    void reconvertImages();
+    void updateCharIcons(const QList<int> &rows);
+    void updateImgIcons(const QList<int> &rows);
+    void generate(const QString &filename);
+    void updateWatchedFiles();
+    bool openBlob(const QString &filename);
     void initPreview();
     void updateFontInfoLabels(const FontInfo*);
+    void updateFontBytesLabel();
     void updateCharInfoLabels(const CharInfo*);
     void updateImgInfoLabels(const ImageInfo*);
     void clearCharInfoLabels();
@@ -73,11 +93,15 @@ private:
     void setGlcdFont();
     void drawGlcd();
     void updateGlcdView();
+    void updateRenderInfo();
 
     Converter converter;
 
     bool isFontFile;
     QString fontFile;
+    QString blobFile;   // previewed binary font, empty if none
+    QString outputFile; // generated last, written again in watch mode
+    SourceWatcher sourceWatcher;
 
     Glcd *glcd;
     GlcdScene *glcdScene;
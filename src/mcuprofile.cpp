@@ -0,0 +1,51 @@
+#include "mcuprofile.h"
+
+
+double McuProfile::cycles(const RenderCost &cost) const
+{
+    return cost.flashBytes*flashByteCycles +
+           cost.ramBytes*ramByteCycles +
+           cost.chunks*chunkCycles +
+           cost.rleBytes*rleByteCycles +
+           cost.lookups*lookupCycles +
+           cost.blits*blitCycles +
+           (cost.glyphs+cost.images)*glyphCycles;
+}
+
+double McuProfile::micros(const RenderCost &cost) const
+{
+    return cycles(cost)/clockMhz;
+}
+
+QList<McuProfile> McuProfile::all()
+{
+    QList<McuProfile> profiles;
+
+    // ICACHE_RODATA_ATTR data is read through the 32 KB flash cache with 32-bit loads.
+    // Misses cost a SPI flash read at 40 MHz QIO, which does not get faster with the CPU clock,
+    // so the per byte flash cost doubles at 160 MHz.
+    McuProfile esp80;
+    esp80.name = "ESP8266 80 MHz";
+    esp80.clockMhz = 80;
+    esp80.flashByteCycles = 2.5;
+    esp80.ramByteCycles = 3;
+    esp80.chunkCycles = 14;
+    esp80.rleByteCycles = 5;
+    esp80.lookupCycles = 10;
+    esp80.blitCycles = 60;
+    esp80.glyphCycles = 25;
+    profiles.append(esp80);
+
+    McuProfile esp160 = esp80;
+    esp160.name = "ESP8266 160 MHz";
+    esp160.clockMhz = 160;
+    esp160.flashByteCycles = 5;
+    profiles.append(esp160);
+
+    return profiles;
+}
+
+McuProfile McuProfile::get(int id)
+{
+    return all().value(id, McuProfile());
+}
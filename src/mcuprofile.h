@@ -0,0 +1,65 @@
+#ifndef MCUPROFILE_H
+#define MCUPROFILE_H
+
+#include <QString>
+#include <QList>
+
+// Work done by the preview display, counted the way the device would do it.
+struct RenderCost{
+    RenderCost(){
+        glyphs = 0;
+        images = 0;
+        flashBytes = 0;
+        ramBytes = 0;
+        blits = 0;
+        chunks = 0;
+        rleBytes = 0;
+        lookups = 0;
+    }
+
+    int glyphs;
+    int images;
+    int flashBytes;     // font and image data read: tables, headers, bitmaps as stored
+    int ramBytes;       // framebuffer bytes read-modify-written
+    int blits;          // blit calls
+    int chunks;         // 32 pixel chunks shifted into place
+    int rleBytes;       // bytes decoded from run-length encoded bitmaps
+    int lookups;        // glyph table entries visited
+};
+
+// Rough cycle costs of a target, to estimate how long drawing takes on it.
+struct McuProfile{
+    enum Id{
+        ESP8266_80MHz = 0, ESP8266_160MHz
+    };
+
+    McuProfile(){
+        clockMhz = 1;
+        flashByteCycles = 0;
+        ramByteCycles = 0;
+        chunkCycles = 0;
+        rleByteCycles = 0;
+        lookupCycles = 0;
+        blitCycles = 0;
+        glyphCycles = 0;
+    }
+
+    QString name;
+    int clockMhz;
+    double flashByteCycles;     // average over cache hits and misses
+    double ramByteCycles;
+    double chunkCycles;
+    double rleByteCycles;
+    double lookupCycles;
+    double blitCycles;          // call, clipping and setup
+    double glyphCycles;         // header decoding per glyph or image
+
+    double cycles(const RenderCost &cost) const;
+    double micros(const RenderCost &cost) const;
+
+    static QList<McuProfile> all();
+    static McuProfile get(int id);
+};
+
+
+#endif // MCUPROFILE_H
@@ -0,0 +1,360 @@
+#include "monopacker.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define MONOPACKER_SSE2
+#    include <emmintrin.h>
+#  endif
+#  if defined(MONOPACKER_SSE2) && (defined(__GNUC__) || (defined(_MSC_VER) && _MSC_VER >= 1700))
+#    define MONOPACKER_AVX2
+#    include <immintrin.h>
+#    if defined(_MSC_VER)
+#      include <intrin.h>
+#    endif
+#  endif
+#endif
+
+#if defined(__GNUC__)
+#  define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#  define TARGET_AVX2
+#endif
+
+
+static uchar reverseBits(uchar b)
+{
+    b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+    b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+    return b;
+}
+
+// ORs n bits (LSB = leftmost pixel) into an LSB-first bit stream at bit position pos.
+static inline void orBits(uchar *dst, int pos, quint32 bits, int n)
+{
+    if (!bits)
+    {
+        return;
+    }
+    quint64 value = (quint64)bits << (pos & 7);
+    uchar *p = dst + (pos >> 3);
+    int bytes = ((pos & 7) + n + 7) >> 3;
+    for (int i = 0; i < bytes; i++)
+    {
+        p[i] |= (uchar)(value >> (i*8));
+    }
+}
+
+static inline bool isInk(QRgb px, int shift, uchar cutoff, bool inkBelow)
+{
+    uchar value = (px >> shift) & 0xFF;
+    return inkBelow ? value < cutoff : value >= cutoff;
+}
+
+static inline uchar grayLevel(QRgb px, int shift, bool inkBelow, int depth)
+{
+    uchar value = (px >> shift) & 0xFF;
+    if (inkBelow)
+    {
+        value = 255-value;
+    }
+    return value >> (8-depth);
+}
+
+// ORs a gray level into a row at pixel pos, the leftmost pixel of a byte in the high or the low bits.
+static inline void orLevel(uchar *dst, int pos, uchar level, int depth, bool lsbFirst)
+{
+    int bit = pos*depth;
+    int shift = lsbFirst ? (bit & 7) : 8-depth-(bit & 7);
+    dst[bit >> 3] |= level << shift;
+}
+
+// Each kernel writes an LSB-first bit stream and returns the number of pixels it consumed,
+// the remaining pixels are handled by the scalar loop.
+
+#ifdef MONOPACKER_SSE2
+static int packSse2(const QRgb *src, int count, int shift, uchar cutoff, bool inkBelow, uchar *dst, int pos)
+{
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    const __m128i cut = _mm_set1_epi8((char)cutoff);
+    const quint32 invert = inkBelow ? 0xFFFF : 0;
+
+    int done = 0;
+    for (; done + 16 <= count; done += 16, pos += 16)
+    {
+        const __m128i *p = (const __m128i*)(src + done);
+        __m128i v0 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p), shiftCount), byteMask);
+        __m128i v1 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p+1), shiftCount), byteMask);
+        __m128i v2 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p+2), shiftCount), byteMask);
+        __m128i v3 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p+3), shiftCount), byteMask);
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+        __m128i atOrAbove = _mm_cmpeq_epi8(_mm_max_epu8(bytes, cut), bytes);
+        quint32 bits = ((quint32)_mm_movemask_epi8(atOrAbove)) ^ invert;
+        orBits(dst, pos, bits, 16);
+    }
+    return done;
+}
+
+// Gray levels of 16 pixels, one per byte.
+static inline __m128i graySse2(const QRgb *src, __m128i shiftCount, __m128i invert, __m128i levelShift,
+                               __m128i levelMask)
+{
+    const __m128i byteMask = _mm_set1_epi32(0xFF);
+    const __m128i *p = (const __m128i*)src;
+    __m128i v0 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p), shiftCount), byteMask);
+    __m128i v1 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p+1), shiftCount), byteMask);
+    __m128i v2 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p+2), shiftCount), byteMask);
+    __m128i v3 = _mm_and_si128(_mm_srl_epi32(_mm_loadu_si128(p+3), shiftCount), byteMask);
+    __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+    // there is no 8-bit shift, the 16-bit shift drags bits across bytes that the mask drops
+    return _mm_and_si128(_mm_srl_epi16(_mm_xor_si128(bytes, invert), levelShift), levelMask);
+}
+
+// Joins the two values of bits each in every 16-bit lane into one value of 2*bits.
+static inline __m128i joinPairs(__m128i lanes, __m128i bits, bool lsbFirst)
+{
+    const __m128i lowByte = _mm_set1_epi16(0xFF);
+    __m128i left = _mm_and_si128(lanes, lowByte);
+    __m128i right = _mm_srli_epi16(lanes, 8);
+    if (lsbFirst)
+    {
+        return _mm_or_si128(left, _mm_sll_epi16(right, bits));
+    }
+    return _mm_or_si128(_mm_sll_epi16(left, bits), right);
+}
+
+// Packs 32 pixels at a time into whole bytes at dst, returns the number of pixels consumed.
+static int packGraySse2(const QRgb *src, int count, int shift, bool inkBelow, int depth, bool lsbFirst, uchar *dst)
+{
+    const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    const __m128i invert = _mm_set1_epi8(inkBelow ? (char)0xFF : 0);
+    const __m128i levelShift = _mm_cvtsi32_si128(8-depth);
+    const __m128i levelMask = _mm_set1_epi8((char)((1 << depth)-1));
+    const __m128i depthBits = _mm_cvtsi32_si128(depth);
+    const __m128i nibbleBits = _mm_cvtsi32_si128(4);
+
+    int done = 0;
+    for (; done + 32 <= count; done += 32)
+    {
+        __m128i a = graySse2(src+done, shiftCount, invert, levelShift, levelMask);
+        __m128i b = graySse2(src+done+16, shiftCount, invert, levelShift, levelMask);
+        // two pixels per byte
+        __m128i pairs = _mm_packus_epi16(joinPairs(a, depthBits, lsbFirst), joinPairs(b, depthBits, lsbFirst));
+        if (depth == 4)
+        {
+            _mm_storeu_si128((__m128i*)dst, pairs);
+            dst += 16;
+        }
+        else
+        {
+            // four pixels per byte
+            __m128i quads = _mm_packus_epi16(joinPairs(pairs, nibbleBits, lsbFirst), _mm_setzero_si128());
+            _mm_storel_epi64((__m128i*)dst, quads);
+            dst += 8;
+        }
+    }
+    return done;
+}
+#endif
+
+#ifdef MONOPACKER_AVX2
+TARGET_AVX2
+static int packAvx2(const QRgb *src, int count, int shift, uchar cutoff, bool inkBelow, uchar *dst, int pos)
+{
+    const __m256i byteMask = _mm256_set1_epi32(0xFF);
+    const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    const __m256i cut = _mm256_set1_epi8((char)cutoff);
+    // undoes the lane interleaving of the two pack instructions
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    const quint32 invert = inkBelow ? 0xFFFFFFFF : 0;
+
+    int done = 0;
+    for (; done + 32 <= count; done += 32, pos += 32)
+    {
+        const __m256i *p = (const __m256i*)(src + done);
+        __m256i v0 = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256(p), shiftCount), byteMask);
+        __m256i v1 = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256(p+1), shiftCount), byteMask);
+        __m256i v2 = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256(p+2), shiftCount), byteMask);
+        __m256i v3 = _mm256_and_si256(_mm256_srl_epi32(_mm256_loadu_si256(p+3), shiftCount), byteMask);
+        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(v0, v1), _mm256_packs_epi32(v2, v3));
+        bytes = _mm256_permutevar8x32_epi32(bytes, order);
+        __m256i atOrAbove = _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, cut), bytes);
+        quint32 bits = ((quint32)_mm256_movemask_epi8(atOrAbove)) ^ invert;
+        orBits(dst, pos, bits, 32);
+    }
+    return done;
+}
+
+static bool cpuHasAvx2()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+    {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1<<27)) != 0;
+    bool avx = (info[2] & (1<<28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1<<5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+
+MonoPacker::MonoPacker(Channel channel, int cutoff, bool inkBelow, bool lsbFirst, int depth):
+    channel(channel),
+    cutoff(qBound(1, cutoff, 255)),
+    inkBelow(inkBelow),
+    lsbFirst(lsbFirst),
+    depth(depth == 2 || depth == 4 ? depth : 1),
+    isa(bestIsa())
+{
+}
+
+MonoPacker::Isa MonoPacker::bestIsa()
+{
+#ifdef MONOPACKER_AVX2
+    static const bool avx2 = cpuHasAvx2();
+    if (avx2)
+    {
+        return AVX2;
+    }
+#endif
+#ifdef MONOPACKER_SSE2
+    return SSE2;
+#else
+    return Scalar;
+#endif
+}
+
+void MonoPacker::setIsa(Isa isa)
+{
+    this->isa = qMin(isa, bestIsa());
+}
+
+void MonoPacker::packRow(const QRgb *src, int count, uchar *dst, int dstBytes, int xoffset) const
+{
+    memset(dst, 0, dstBytes);
+
+    if (xoffset < 0)
+    {
+        src -= xoffset;
+        count += xoffset;
+        xoffset = 0;
+    }
+    if (xoffset + count > dstBytes*8/depth)
+    {
+        count = dstBytes*8/depth - xoffset;
+    }
+    if (count <= 0)
+    {
+        return;
+    }
+    if (depth > 1)
+    {
+        packGrayRow(src, count, dst, xoffset);
+        return;
+    }
+
+    int shift = channel;
+    int done = 0;
+#ifdef MONOPACKER_AVX2
+    if (isa == AVX2)
+    {
+        done = packAvx2(src, count, shift, cutoff, inkBelow, dst, xoffset);
+    }
+#endif
+#ifdef MONOPACKER_SSE2
+    if (isa >= SSE2)
+    {
+        done += packSse2(src+done, count-done, shift, cutoff, inkBelow, dst, xoffset+done);
+    }
+#endif
+    for (int i = done; i < count; i++)
+    {
+        if (isInk(src[i], shift, cutoff, inkBelow))
+        {
+            int pos = xoffset+i;
+            dst[pos >> 3] |= 1 << (pos & 7);
+        }
+    }
+
+    if (!lsbFirst)
+    {
+        int firstByte = xoffset >> 3;
+        int lastByte = (xoffset+count-1) >> 3;
+        for (int i = firstByte; i <= lastByte; i++)
+        {
+            dst[i] = reverseBits(dst[i]);
+        }
+    }
+}
+
+// Pixels before the first byte boundary and after the last full block are scalar,
+// the bytes in between are written by the kernel.
+void MonoPacker::packGrayRow(const QRgb *src, int count, uchar *dst, int xoffset) const
+{
+    int shift = channel;
+    int perByte = 8/depth;
+    int head = qMin(count, (perByte - xoffset%perByte)%perByte);
+    for (int i = 0; i < head; i++)
+    {
+        orLevel(dst, xoffset+i, grayLevel(src[i], shift, inkBelow, depth), depth, lsbFirst);
+    }
+
+    int done = head;
+#ifdef MONOPACKER_SSE2
+    if (isa >= SSE2)
+    {
+        done += packGraySse2(src+done, count-done, shift, inkBelow, depth, lsbFirst,
+                             dst + (xoffset+done)*depth/8);
+    }
+#endif
+    for (int i = done; i < count; i++)
+    {
+        orLevel(dst, xoffset+i, grayLevel(src[i], shift, inkBelow, depth), depth, lsbFirst);
+    }
+}
+
+void MonoPacker::pack(const QImage &src, const QRect &rect, uchar *dst, int dstWidth, int xoffset) const
+{
+    int dstBytes = dstWidth*depth/8;
+
+    // clip the source rect to the image, pixels outside it stay clear
+    int srcX = rect.x();
+    int count = rect.width();
+    if (srcX < 0)
+    {
+        xoffset -= srcX;
+        count += srcX;
+        srcX = 0;
+    }
+    if (srcX + count > src.width())
+    {
+        count = src.width() - srcX;
+    }
+
+    for (int row = 0; row < rect.height(); row++, dst += dstBytes)
+    {
+        int srcY = rect.y()+row;
+        if (count <= 0 || srcY < 0 || srcY >= src.height())
+        {
+            memset(dst, 0, dstBytes);
+            continue;
+        }
+        const QRgb *line = (const QRgb*)src.constScanLine(srcY) + srcX;
+        packRow(line, count, dst, dstBytes, xoffset);
+    }
+}
@@ -0,0 +1,52 @@
+#ifndef MONOPACKER_H
+#define MONOPACKER_H
+
+#include <QImage>
+#include <QRect>
+
+// Thresholds one channel of a 32-bit image and packs the result into 1bpp rows, or quantizes
+// it to 2 or 4 bit gray levels (0 = no ink) packed 4 or 2 pixels per byte.
+// Rows are vectorized with AVX2 or SSE2 when the CPU supports it, gray rows with SSE2.
+class MonoPacker
+{
+public:
+    enum Channel{
+        Blue = 0, Green = 8, Red = 16, Alpha = 24     // bit shift within QRgb
+    };
+    enum Isa{
+        Scalar = 0, SSE2, AVX2
+    };
+
+    // inkBelow: pixels with a channel value below the cutoff are set (dark glyph on light background),
+    // otherwise pixels with a value at or above the cutoff are set (coverage in the channel).
+    // Gray levels are the ink coverage the same way, the cutoff does not apply to them.
+    // depth is the bits per pixel: 1, 2 or 4. lsbFirst puts the leftmost pixel in the low bits.
+    MonoPacker(Channel channel = Green, int cutoff = 128, bool inkBelow = true, bool lsbFirst = false,
+               int depth = 1);
+
+    int getDepth() const { return depth; }
+
+    // Packs count pixels into a zeroed row of dstBytes bytes, starting at pixel xoffset.
+    // Pixels that fall outside the row are clipped.
+    void packRow(const QRgb *src, int count, uchar *dst, int dstBytes, int xoffset) const;
+
+    // Packs rect of src (Format_ARGB32 or Format_RGB32) into rows of dstWidth*depth/8 bytes,
+    // centered by xoffset. dst must hold dstWidth*depth/8*rect.height() bytes.
+    void pack(const QImage &src, const QRect &rect, uchar *dst, int dstWidth, int xoffset) const;
+
+    static Isa bestIsa();
+    void setIsa(Isa isa);   // for benchmarks, defaults to bestIsa()
+
+private:
+    void packGrayRow(const QRgb *src, int count, uchar *dst, int xoffset) const;
+
+    Channel channel;
+    uchar cutoff;
+    bool inkBelow;
+    bool lsbFirst;
+    int depth;
+    Isa isa;
+};
+
+
+#endif // MONOPACKER_H
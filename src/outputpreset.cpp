@@ -0,0 +1,36 @@
+#include "outputpreset.h"
+
+
+QList<OutputPreset> OutputPreset::all()
+{
+    QList<OutputPreset> presets;
+
+    OutputPreset esp;
+    esp.name = "ESP8266";
+    esp.includes = "#include <ets_sys.h>\n";
+    esp.arraySyntax1 = "static const unsigned int %1[%2] ICACHE_RODATA_ATTR={";
+    esp.arraySyntax2 = "const unsigned int *%1[%2] ={";
+    esp.bitcount32 = true;
+    presets.append(esp);
+
+    OutputPreset generic8;
+    generic8.name = "Generic (8 bit)";
+    generic8.arraySyntax1 = "static const unsigned char %1[%2] ={";
+    generic8.arraySyntax2 = "const unsigned char *%1[%2] ={";
+    generic8.bitcount32 = false;
+    presets.append(generic8);
+
+    OutputPreset generic32;
+    generic32.name = "Generic (32 bit)";
+    generic32.arraySyntax1 = "static const unsigned int %1[%2] ={";
+    generic32.arraySyntax2 = "const unsigned int *%1[%2] ={";
+    generic32.bitcount32 = true;
+    presets.append(generic32);
+
+    return presets;
+}
+
+OutputPreset OutputPreset::get(int id)
+{
+    return all().value(id, OutputPreset());
+}
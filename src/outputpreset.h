@@ -0,0 +1,27 @@
+#ifndef OUTPUTPRESET_H
+#define OUTPUTPRESET_H
+
+#include <QString>
+#include <QList>
+
+struct OutputPreset{
+    enum Id{
+        ESP8266 = 0, Generic_8bit, Generic_32bit
+    };
+
+    OutputPreset(){
+        bitcount32 = false;
+    }
+
+    QString name;
+    QString includes;
+    QString arraySyntax1;
+    QString arraySyntax2;
+    bool bitcount32;
+
+    static QList<OutputPreset> all();
+    static OutputPreset get(int id);
+};
+
+
+#endif // OUTPUTPRESET_H
@@ -0,0 +1,107 @@
+#include "rasterizer.h"
+#include <QPainter>
+
+
+static int centerOffset(int targetWidth, int width)
+{
+    return ((double)(targetWidth-width))/2 + 0.5;
+}
+
+int Rasterizer::targetWidth(int width, int xadvance, int threshold, bool &scaled)
+{
+    scaled = false;
+    int mod = xadvance%8;
+    if (mod)
+    {
+        if (mod <= threshold && xadvance > 8)   // cut width
+        {
+            xadvance -= mod;
+            if (xadvance < width)   // scale pic
+            {
+                scaled = true;
+            }
+        }
+        else    // increase width
+        {
+            xadvance += (8-mod);
+        }
+    }
+    return xadvance;
+}
+
+int Rasterizer::bitmapOffset(int width, int targetWidth, bool scaled)
+{
+    return scaled ? 0 : centerOffset(targetWidth, width);
+}
+
+QImage Rasterizer::paint(const QImage &src, const QRect &rect, int targetWidth, bool scaled)
+{
+    QImage charPic = src.copy(rect);
+    int width = rect.width();
+    int height = rect.height();
+
+    if (scaled)
+    {
+        return charPic.scaled(targetWidth, height, Qt::IgnoreAspectRatio, Qt::FastTransformation);
+    }
+
+    int xoffset = centerOffset(targetWidth, width);
+    QImage newImg(targetWidth, height, QImage::Format_RGB32);
+    newImg.fill(Qt::white);
+
+    QRectF source(0.0, 0.0, width, height);
+    QRectF target(xoffset, 0.0, width, height);
+    QPainter painter;
+    painter.begin(&newImg);
+    painter.drawImage(target, charPic, source);
+    painter.end();
+
+    return newImg;
+}
+
+QByteArray Rasterizer::packImage(const QImage &image, int depth, Dither::Method dither)
+{
+    if (depth > 1 || dither != Dither::Threshold)
+    {
+        QImage gray = image.convertToFormat(QImage::Format_Grayscale8);
+        Dither(dither, depth).apply(gray);
+        gray = gray.convertToFormat(QImage::Format_RGB32);
+        MonoPacker packer(MonoPacker::Green, 128, true, false, depth);
+        QByteArray bitmap(gray.width()*depth/8*gray.height(), 0);
+        packer.pack(gray, gray.rect(), (uchar*)bitmap.data(), gray.width(), 0);
+        return bitmap;
+    }
+
+    QImage mono = image.convertToFormat(QImage::Format_Mono, Qt::MonoOnly);
+    int byteWidth = mono.width()/8;
+    QByteArray bitmap(byteWidth*mono.height(), 0);
+    for (int y = 0; y < mono.height(); y++)
+    {
+        memcpy(bitmap.data()+y*byteWidth, mono.constScanLine(y), byteWidth);
+    }
+    return bitmap;
+}
+
+QByteArray Rasterizer::pack(const QImage &atlas, const QRect &rect, int targetWidth, bool scaled,
+                            const MonoPacker &packer)
+{
+    if (targetWidth <= 0 || rect.height() <= 0)
+    {
+        return QByteArray();
+    }
+
+    QByteArray bitmap(targetWidth*packer.getDepth()/8*rect.height(), 0);
+    uchar *dst = (uchar*)bitmap.data();
+    if (scaled)
+    {
+        QImage charPic = atlas.copy(rect).scaled(targetWidth, rect.height(),
+                                                 Qt::IgnoreAspectRatio, Qt::FastTransformation);
+        charPic = charPic.convertToFormat(QImage::Format_ARGB32);
+        packer.pack(charPic, charPic.rect(), dst, targetWidth, 0);
+    }
+    else
+    {
+        packer.pack(atlas, rect, dst, targetWidth, centerOffset(targetWidth, rect.width()));
+    }
+    return bitmap;
+}
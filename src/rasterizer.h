@@ -0,0 +1,37 @@
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <QImage>
+#include <QByteArray>
+#include <QRect>
+#include "monopacker.h"
+#include "dither.h"
+
+// Turns a rectangle of a source image into a bitmap whose width is a multiple of 8.
+// Bitmaps are packed rows of width/8 bytes, MSB first, a set bit is a black pixel.
+// Gray bitmaps have width*depth/8 bytes per row, the leftmost pixel in the high bits, 0 is white.
+class Rasterizer
+{
+public:
+    // Bitmap width for a glyph: xadvance padded up to the next multiple of 8, or cut down
+    // when the remainder is within the threshold. scaled is set when the cut width is
+    // narrower than the glyph itself.
+    static int targetWidth(int width, int xadvance, int threshold, bool &scaled);
+
+    // Position of the glyph's left edge within its bitmap: centered, or 0 when scaled down.
+    static int bitmapOffset(int width, int targetWidth, bool scaled);
+
+    // QPainter path: composites the rect onto a white background (centered) or scales it
+    // down to targetWidth, then thresholds the result to 1bpp or quantizes its luminance to
+    // gray levels, or dithers it with the given method.
+    static QImage paint(const QImage &src, const QRect &rect, int targetWidth, bool scaled);
+    static QByteArray packImage(const QImage &image, int depth = 1, Dither::Method dither = Dither::Threshold);
+
+    // Direct path: thresholds one channel of the atlas (Format_ARGB32) and packs it
+    // straight into the bitmap. Only scaled glyphs go through an intermediate image.
+    static QByteArray pack(const QImage &atlas, const QRect &rect, int targetWidth, bool scaled,
+                           const MonoPacker &packer);
+};
+
+
+#endif // RASTERIZER_H
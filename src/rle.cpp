@@ -0,0 +1,72 @@
+#include "rle.h"
+#include <string.h>
+
+
+static int runLength(const uchar *src, int pos, int size)
+{
+    int run = 1;
+    while (pos+run < size && run < 128 && src[pos+run] == src[pos])
+    {
+        run++;
+    }
+    return run;
+}
+
+QByteArray Rle::encode(const QByteArray &data)
+{
+    const uchar *src = (const uchar*)data.constData();
+    int size = data.size();
+
+    QByteArray out;
+    out.reserve(size + size/128 + 1);
+    int pos = 0;
+    while (pos < size)
+    {
+        int run = runLength(src, pos, size);
+        if (run >= 2)
+        {
+            out.append((char)(257-run));
+            out.append((char)src[pos]);
+            pos += run;
+            continue;
+        }
+
+        // literal bytes up to the next run of three, a run of two is cheaper inside the literal
+        int start = pos;
+        while (pos < size && pos-start < 128 && (pos == start || runLength(src, pos, size) < 3))
+        {
+            pos++;
+        }
+        out.append((char)(pos-start-1));
+        out.append((const char*)src+start, pos-start);
+    }
+    return out;
+}
+
+int Rle::decode(const uchar *src, int srcSize, uchar *dst, int dstSize, int *srcRead)
+{
+    int in = 0;
+    int out = 0;
+    while (in < srcSize && out < dstSize)
+    {
+        int n = src[in++];
+        if (n < 128)
+        {
+            int count = qMin(qMin(n+1, srcSize-in), dstSize-out);
+            memcpy(dst+out, src+in, count);
+            in += n+1;
+            out += count;
+        }
+        else if (n > 128 && in < srcSize)
+        {
+            int count = qMin(257-n, dstSize-out);
+            memset(dst+out, src[in++], count);
+            out += count;
+        }
+    }
+    if (srcRead)
+    {
+        *srcRead = qMin(in, srcSize);
+    }
+    return out;
+}
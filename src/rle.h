@@ -0,0 +1,20 @@
+#ifndef RLE_H
+#define RLE_H
+
+#include <QByteArray>
+
+// PackBits run-length coding of packed bitmap rows, the rows of a bitmap are coded as one stream.
+// Control byte n: 0-127 copies the next n+1 bytes, 129-255 repeats the next byte 257-n times,
+// 128 is never written and skipped by the decoder.
+class Rle
+{
+public:
+    static QByteArray encode(const QByteArray &data);
+
+    // Decodes until dstSize bytes are written or srcSize bytes are read,
+    // returns the number of bytes written. srcRead is set to the number of bytes read.
+    static int decode(const uchar *src, int srcSize, uchar *dst, int dstSize, int *srcRead = NULL);
+};
+
+
+#endif // RLE_H
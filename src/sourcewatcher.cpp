@@ -0,0 +1,93 @@
+#include "sourcewatcher.h"
+#include <QFileInfo>
+
+
+SourceWatcher::SourceWatcher(QObject *parent):
+    QObject(parent)
+{
+    settleTimer.setSingleShot(true);
+    settleTimer.setInterval(settleMs);
+    connect(&watcher, SIGNAL(fileChanged(QString)), this, SLOT(fileChanged(QString)));
+    connect(&watcher, SIGNAL(directoryChanged(QString)), this, SLOT(directoryChanged(QString)));
+    connect(&settleTimer, SIGNAL(timeout()), this, SLOT(emitChanged()));
+}
+
+void SourceWatcher::setFiles(const QStringList &files)
+{
+    if (!watcher.files().isEmpty())
+    {
+        watcher.removePaths(watcher.files());
+    }
+    if (!watcher.directories().isEmpty())
+    {
+        watcher.removePaths(watcher.directories());
+    }
+    this->files = files;
+    pending.clear();
+    settleTimer.stop();
+
+    QStringList dirs;
+    foreach (const QString &file, files)
+    {
+        QFileInfo info(file);
+        if (info.exists())
+        {
+            watcher.addPath(file);
+        }
+        if (!dirs.contains(info.absolutePath()))
+        {
+            dirs.append(info.absolutePath());
+        }
+    }
+    if (!dirs.isEmpty())
+    {
+        watcher.addPaths(dirs);
+    }
+}
+
+void SourceWatcher::markChanged(const QString &file)
+{
+    pending.insert(file);
+    settleTimer.start();
+}
+
+void SourceWatcher::fileChanged(const QString &file)
+{
+    if (!watcher.files().contains(file) && QFileInfo::exists(file))
+    {
+        watcher.addPath(file);
+    }
+    markChanged(file);
+}
+
+// A file that was replaced or deleted and written again shows up as a change of its directory.
+void SourceWatcher::directoryChanged(const QString &dir)
+{
+    QStringList watched = watcher.files();
+    foreach (const QString &file, files)
+    {
+        if (!watched.contains(file) && QFileInfo(file).absolutePath() == dir && QFileInfo::exists(file))
+        {
+            watcher.addPath(file);
+            markChanged(file);
+        }
+    }
+}
+
+void SourceWatcher::emitChanged()
+{
+    // a file that is gone is reported when it is written again
+    QStringList changed;
+    foreach (const QString &file, files)
+    {
+        if (pending.contains(file) && QFileInfo::exists(file))
+        {
+            changed.append(file);
+        }
+    }
+    pending.clear();
+    if (!changed.isEmpty())
+    {
+        emit filesChanged(changed);
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef SOURCEWATCHER_H
+#define SOURCEWATCHER_H
+
+#include <QObject>
+#include <QFileSystemWatcher>
+#include <QTimer>
+#include <QStringList>
+#include <QSet>
+
+// Watches the source files of a conversion and reports them once they have settled.
+// Editors save in several writes, or write a new file and rename it over the old one, which
+// drops the file from QFileSystemWatcher; the directories are watched too to pick it up again.
+class SourceWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SourceWatcher(QObject *parent = NULL);
+
+    void setFiles(const QStringList &files);
+    const QStringList &getFiles() const { return files; }
+
+signals:
+    // Changed files in the order of setFiles(), sent when nothing changed for settleMs.
+    void filesChanged(const QStringList &files);
+
+private slots:
+    void fileChanged(const QString &file);
+    void directoryChanged(const QString &dir);
+    void emitChanged();
+
+private:
+    void markChanged(const QString &file);
+
+    static const int settleMs = 200;
+
+    QFileSystemWatcher watcher;
+    QTimer settleTimer;
+    QStringList files;
+    QSet<QString> pending;
+};
+
+
+#endif // SOURCEWATCHER_H
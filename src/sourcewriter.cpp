@@ -0,0 +1,119 @@
+#include "sourcewriter.h"
+#include <string.h>
+
+
+// Two upper case hex digits for every byte value, so a byte costs one 16 bit copy.
+struct HexTable{
+    HexTable(){
+        for (int i = 0; i < 256; i++)
+        {
+            digits[i][0] = "0123456789ABCDEF"[i >> 4];
+            digits[i][1] = "0123456789ABCDEF"[i & 0x0F];
+        }
+    }
+    char digits[256][2];
+};
+
+static const HexTable hexTable;
+
+
+SourceWriter::SourceWriter(int reserve):
+    used(0)
+{
+    buffer.resize(qMax(reserve, 4096));
+}
+
+void SourceWriter::reallocate(int minSize)
+{
+    int newSize = buffer.size()*2;
+    if (newSize < minSize)
+    {
+        newSize = minSize;
+    }
+    buffer.resize(newSize);
+}
+
+SourceWriter &SourceWriter::operator<<(const char *str)
+{
+    int len = strlen(str);
+    memcpy(grow(len), str, len);
+    return *this;
+}
+
+SourceWriter &SourceWriter::operator<<(const QString &str)
+{
+    QByteArray encoded = str.toLocal8Bit();
+    memcpy(grow(encoded.size()), encoded.constData(), encoded.size());
+    return *this;
+}
+
+SourceWriter &SourceWriter::operator<<(int value)
+{
+    char digits[12];
+    int len = 0;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    do
+    {
+        digits[len++] = '0' + magnitude%10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0)
+    {
+        digits[len++] = '-';
+    }
+
+    char *p = grow(len);
+    while (len)
+    {
+        *p++ = digits[--len];
+    }
+    return *this;
+}
+
+void SourceWriter::hexBytes(const uchar *data, int count)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // "0xHH," is 5 characters, the last value has no separator
+    char *p = grow(count*5 - 1);
+    for (int i = 0; i < count; i++)
+    {
+        p[0] = '0';
+        p[1] = 'x';
+        memcpy(p+2, hexTable.digits[data[i]], 2);
+        if (i < count-1)
+        {
+            p[4] = ',';
+        }
+        p += 5;
+    }
+}
+
+void SourceWriter::hexWords(const uint *data, int count)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // "0xHHHHHHHH," is 11 characters, the last value has no separator
+    char *p = grow(count*11 - 1);
+    for (int i = 0; i < count; i++)
+    {
+        uint value = data[i];
+        p[0] = '0';
+        p[1] = 'x';
+        memcpy(p+2, hexTable.digits[(value >> 24) & 0xFF], 2);
+        memcpy(p+4, hexTable.digits[(value >> 16) & 0xFF], 2);
+        memcpy(p+6, hexTable.digits[(value >> 8) & 0xFF], 2);
+        memcpy(p+8, hexTable.digits[value & 0xFF], 2);
+        if (i < count-1)
+        {
+            p[10] = ',';
+        }
+        p += 11;
+    }
+}
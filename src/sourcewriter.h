@@ -0,0 +1,44 @@
+#ifndef SOURCEWRITER_H
+#define SOURCEWRITER_H
+
+#include <QByteArray>
+#include <QString>
+
+// Builds a C source file in one preallocated buffer, which is written with a single call.
+// Text is encoded with the locale codec, the same as QTextStream does by default.
+class SourceWriter
+{
+public:
+    explicit SourceWriter(int reserve = 0);
+
+    SourceWriter &operator<<(const char *str);
+    SourceWriter &operator<<(const QString &str);
+    SourceWriter &operator<<(int value);
+
+    // Writes 8 bit values as "0xHH,0xHH,...,0xHH" (no trailing separator).
+    void hexBytes(const uchar *data, int count);
+    // Writes 32 bit values as "0xHHHHHHHH,...,0xHHHHHHHH" (no trailing separator).
+    void hexWords(const uint *data, int count);
+
+    int size() const { return used; }
+    const QByteArray data() const { return buffer.left(used); }
+
+private:
+    char *grow(int bytes)
+    {
+        if (used + bytes > buffer.size())
+        {
+            reallocate(used + bytes);
+        }
+        char *p = buffer.data() + used;
+        used += bytes;
+        return p;
+    }
+    void reallocate(int minSize);
+
+    QByteArray buffer;
+    int used;
+};
+
+
+#endif // SOURCEWRITER_H